@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cairo.h>
+#include "state.h"
+#include "buffer.h"
+#include "draw.h"
+
+// Headless benchmark: feeds synthetic key streams through the segment buffer
+// and draw_frame() into offscreen image surfaces. No compositor needed.
+
+// Count every heap allocation in the process, including cairo/pixman/fontconfig
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count;
+
+void *malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+struct bench_key {
+    uint8_t mods;
+    xkb_keysym_t keysym;
+    char text[SEG_TEXT_MAX];
+};
+
+static const char sample_text[] = "the quick brown fox jumps over the lazy dog ";
+
+static void next_plain(int i, struct bench_key *key) {
+    char c = sample_text[i % (sizeof(sample_text) - 1)];
+    key->mods = 0;
+    key->keysym = c == ' ' ? XKB_KEY_space : (xkb_keysym_t)c;
+    key->text[0] = c;
+    key->text[1] = '\0';
+}
+
+static void next_combo(int i, struct bench_key *key) {
+    static const uint8_t mods[] = {
+        SEG_MOD_CTRL, SEG_MOD_CTRL | SEG_MOD_ALT, SEG_MOD_SUPER,
+        SEG_MOD_ALT, SEG_MOD_CTRL | SEG_MOD_SUPER, SEG_MOD_CTRL | SEG_MOD_ALT | SEG_MOD_SUPER,
+    };
+    char c = 'a' + i % 26;
+    key->mods = mods[i % (sizeof(mods) / sizeof(mods[0]))];
+    key->keysym = (xkb_keysym_t)c;
+    key->text[0] = c;
+    key->text[1] = '\0';
+}
+
+static void next_navigation(int i, struct bench_key *key) {
+    static const struct { xkb_keysym_t keysym; const char *label; } keys[] = {
+        { XKB_KEY_Left, "Left" }, { XKB_KEY_Left, "Left" }, { XKB_KEY_Down, "Down" },
+        { XKB_KEY_Right, "Right" }, { XKB_KEY_Up, "Up" }, { XKB_KEY_Return, "Enter" },
+        { XKB_KEY_Tab, "Tab" }, { XKB_KEY_Home, "Home" }, { XKB_KEY_End, "End" },
+        { XKB_KEY_Prior, "PgUp" }, { XKB_KEY_Next, "PgDn" }, { XKB_KEY_Delete, "Del" },
+    };
+    int k = i % (int)(sizeof(keys) / sizeof(keys[0]));
+    key->mods = (i % 7 == 0) ? SEG_MOD_CTRL : 0;
+    key->keysym = keys[k].keysym;
+    snprintf(key->text, sizeof(key->text), "%s", keys[k].label);
+}
+
+struct workload {
+    const char *name;
+    int font_size;
+    int width, height;
+    int prefill; // Start from a full segment history
+    void (*next)(int i, struct bench_key *key);
+};
+
+static const struct workload workloads[] = {
+    { "plain",      65,  DEFAULT_WIDTH, DEFAULT_HEIGHT, 0, next_plain },
+    { "combos",     65,  DEFAULT_WIDTH, DEFAULT_HEIGHT, 0, next_combo },
+    { "navigation", 65,  DEFAULT_WIDTH, DEFAULT_HEIGHT, 0, next_navigation },
+    { "history",    65,  DEFAULT_WIDTH, DEFAULT_HEIGHT, 1, next_plain },
+    { "large",      140, 2560,          320,            1, next_combo },
+};
+
+// Same separator and colour rules as process_key_action()
+static void feed_key(struct client_state *state, const struct bench_key *key) {
+    state->use_combo_color = key->mods != 0;
+    if (buf_repeat(state, key->mods, key->keysym, key->text)) return;
+    
+    int icon = icon_for_keysym(key->keysym);
+    const struct segment *last = buf_last(state);
+    if (last) {
+        int prev_is_special = (last->mods || strlen(last->text) > 1);
+        int this_is_special = (key->mods || strlen(key->text) > 1);
+        if (prev_is_special || this_is_special) buf_append(state, 0, XKB_KEY_NoSymbol, ICON_NONE, " ");
+    }
+    buf_append(state, key->mods, key->keysym, icon, key->text);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int run_workload(struct client_state *state, const struct workload *w, int frames) {
+    state->font_size = w->font_size;
+    state->width = w->width;
+    state->height = w->height;
+    buf_clear(state);
+    state->last_frame.valid = 0;
+
+    // The compositor holds on to the frame on screen, so rendering alternates
+    // between two buffers like the shm pool does under steady typing
+    struct shm_buffer buffers[2] = {0};
+    for (int i = 0; i < 2; i++) {
+        buffers[i].surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w->width, w->height);
+        if (cairo_surface_status(buffers[i].surface) != CAIRO_STATUS_SUCCESS) return -1;
+        buffers[i].data = cairo_image_surface_get_data(buffers[i].surface);
+    }
+
+    struct bench_key key;
+    int seq = 0;
+    if (w->prefill) {
+        while (state->seg_count < MAX_SEGMENTS) {
+            w->next(seq++, &key);
+            feed_key(state, &key);
+        }
+    }
+
+    // Warm the segment cache and font state before measuring
+    const int warmup = frames / 10 + 1;
+    for (int i = 0; i < warmup; i++) {
+        w->next(seq++, &key);
+        feed_key(state, &key);
+        draw_frame(state, &buffers[i & 1]);
+    }
+
+    unsigned long allocs = alloc_count;
+    uint64_t start = now_ns();
+    for (int i = 0; i < frames; i++) {
+        w->next(seq++, &key);
+        feed_key(state, &key);
+        draw_frame(state, &buffers[i & 1]);
+    }
+    uint64_t elapsed = now_ns() - start;
+    allocs = alloc_count - allocs;
+
+    printf("%-12s %5d %4dx%-4d %10.0f %12.0f %12.2f\n", w->name, w->font_size, w->width, w->height,
+           frames / (elapsed / 1e9), (double)elapsed / frames, (double)allocs / frames);
+
+    state->last_frame.valid = 0;
+    for (int i = 0; i < 2; i++) cairo_surface_destroy(buffers[i].surface);
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-n frames] [workload...]\n", prog);
+    printf("Workloads:");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) printf(" %s", workloads[i].name);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 2000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                frames = atoi(optarg);
+                if (frames < 1) frames = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    struct client_state state = {0};
+    state.window_visible = 1;
+    state.overlay_enabled = 1;
+    state.bg_color[3] = 0.6;
+    for (int i = 0; i < 4; i++) state.text_color[i] = 1.0;
+    state.current_combo_color[0] = 0.36;
+    state.current_combo_color[1] = 0.68;
+    state.current_combo_color[2] = 0.89;
+    state.current_combo_color[3] = 1.0;
+    if (font_init(&state.font, NULL, NULL) != 0 || font_init(&state.mouse_font, NULL, &state.font) != 0) return 1;
+    font_set_weight(&state.mouse_font, PANGO_WEIGHT_NORMAL);
+
+    printf("%-12s %5s %9s %10s %12s %12s\n", "workload", "font", "size", "frames/s", "ns/frame", "allocs/frame");
+    int rc = 0;
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        int selected = optind >= argc;
+        for (int a = optind; a < argc; a++) {
+            if (strcmp(argv[a], workloads[i].name) == 0) selected = 1;
+        }
+        if (selected && run_workload(&state, &workloads[i], frames) != 0) {
+            fprintf(stderr, "%s: failed to create image surfaces\n", workloads[i].name);
+            rc = 1;
+        }
+    }
+
+    seg_cache_clear(&state.seg_cache);
+    icon_atlas_destroy(&state.icon_atlas);
+    font_destroy(&state.font);
+    font_destroy(&state.mouse_font);
+    return rc;
+}
@@ -1,93 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "buffer.h"
+#include "draw.h"
 
-static void buf_shift_left(struct client_state *state) {
+int seg_format_mods(uint8_t mods, char *out, size_t size) {
+    return snprintf(out, size, "%s%s%s",
+                    (mods & SEG_MOD_CTRL) ? "Ctrl+" : "",
+                    (mods & SEG_MOD_ALT) ? "Alt+" : "",
+                    (mods & SEG_MOD_SUPER) ? "Super+" : "");
+}
+
+int seg_format_count(const struct segment *seg, char *out, size_t size) {
+    if (seg->count > 1) return snprintf(out, size, "×%u", (unsigned int)seg->count);
+    if (size > 0) out[0] = '\0';
+    return 0;
+}
+
+int seg_format(const struct segment *seg, char *out, size_t size) {
+    int len = seg_format_mods(seg->mods, out, size);
+    if (len < 0 || (size_t)len >= size) return len;
+    len += snprintf(out + len, size - len, "%s", seg->text);
+    if ((size_t)len >= size) return len;
+    return len + seg_format_count(seg, out + len, size - len);
+}
+
+static uint64_t now_usec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int seg_is_space(const struct segment *seg) {
+    return seg->mods == 0 && strcmp(seg->text, " ") == 0;
+}
+
+struct segment *buf_append(struct client_state *state, uint8_t mods, xkb_keysym_t keysym, int icon, const char *text) {
+    if (state->seg_count == MAX_SEGMENTS) {
+        // Ring full: drop the oldest
+        state->seg_head = (state->seg_head + 1) & (MAX_SEGMENTS - 1);
+        state->seg_count--;
+    }
+
+    const struct segment *prev = buf_last(state);
+    double prev_end = prev ? prev->end : 0;
+
+    struct segment *seg = buf_segment(state, state->seg_count++);
+    seg->id = ++state->next_seg_id;
+    seg->mods = mods;
+    seg->icon = icon;
+    seg->keysym = keysym;
+    seg->count = 1;
+    snprintf(seg->text, sizeof(seg->text), "%s", text);
+
+    seg->width = measure_segment(state, seg);
+    seg->end = prev_end + seg->width;
+    seg->time_usec = now_usec();
+    return seg;
+}
+
+// Drops the newest segment whole, whatever its count
+static void buf_pop(struct client_state *state) {
     if (state->seg_count == 0) return;
-    int len_to_remove = state->seg_lengths[0];
-    memmove(state->display_buf, state->display_buf + len_to_remove, state->display_len - len_to_remove + 1);
-    state->display_len -= len_to_remove;
-    memmove(state->seg_lengths, state->seg_lengths + 1, (state->seg_count - 1) * sizeof(int));
     state->seg_count--;
 }
 
-void buf_append(struct client_state *state, const char *text) {
-    size_t text_len = strlen(text);
-    if (text_len == 0) return;
-
-    if (state->seg_count >= MAX_SEGMENTS) buf_shift_left(state);
+static int seg_same_key(const struct segment *seg, uint8_t mods, xkb_keysym_t keysym, const char *text) {
+    return keysym != XKB_KEY_NoSymbol && seg->keysym == keysym && seg->mods == mods &&
+           strcmp(seg->text, text) == 0;
+}
 
-    while (state->display_len + text_len >= MAX_DISPLAY_LEN) {
-        buf_shift_left(state);
-        // Safety break if buffer is full of one huge segment (unlikely)
-        if (state->seg_count == 0) {
-            state->display_len = 0;
-            break;
-        }
+struct segment *buf_repeat(struct client_state *state, uint8_t mods, xkb_keysym_t keysym, const char *text) {
+    struct segment *seg = buf_last(state);
+    if (!seg || !seg_same_key(seg, mods, keysym, text)) return NULL;
+    
+    if (!mods && strlen(text) == 1 && seg->count == 1) {
+        // A plain character needs two copies already in the buffer
+        if (state->seg_count < 2) return NULL;
+        struct segment *first = buf_segment(state, state->seg_count - 2);
+        if (first->count != 1 || !seg_same_key(first, mods, keysym, text)) return NULL;
+        buf_pop(state);
+        seg = first;
+        seg->count = 3;
+    } else if (seg->count < UINT16_MAX) {
+        seg->count++;
     }
+    
+    // New pixels, so a new id: the previous frame must not be reused for it
+    seg->id = ++state->next_seg_id;
+    const double start = seg->end - seg->width;
+    seg->width = measure_segment(state, seg);
+    seg->end = start + seg->width;
+    seg->time_usec = now_usec();
+    return seg;
+}
 
-    memcpy(state->display_buf + state->display_len, text, text_len + 1);
-    state->display_len += text_len;
-    state->seg_lengths[state->seg_count++] = text_len;
+int buf_fit_start(struct client_state *state, double max_width) {
+    if (state->seg_count == 0) return 0;
+    const double end = buf_last(state)->end;
+    // Width of segments [i, last] is end - (end_i - width_i), which shrinks as
+    // i grows, so binary search for the first i that fits
+    int lo = 0, hi = state->seg_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const struct segment *seg = buf_segment(state, mid);
+        if (end - (seg->end - seg->width) <= max_width) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
 }
 
 void buf_backspace(struct client_state *state) {
-    if (state->seg_count == 0) return;
-    int len_to_remove = state->seg_lengths[--state->seg_count];
-    if (len_to_remove > (int)state->display_len) len_to_remove = state->display_len;
-    state->display_len -= len_to_remove;
-    state->display_buf[state->display_len] = '\0';
+    struct segment *seg = buf_last(state);
+    if (!seg) return;
+    if (seg->count == 1) {
+        buf_pop(state);
+        return;
+    }
+    
+    // Take back one press of a counted run, e.g. "l×4" becomes "l×3"
+    seg->count--;
+    // A plain character only collapses from its third press, so two left over
+    // go back to being the "ll" that was typed
+    const int split = !seg->mods && strlen(seg->text) == 1 && seg->count == 2;
+    if (split) seg->count = 1;
+    seg->id = ++state->next_seg_id;
+    const double start = seg->end - seg->width;
+    seg->width = measure_segment(state, seg);
+    seg->end = start + seg->width;
+    if (split) buf_append(state, seg->mods, seg->keysym, seg->icon, seg->text);
+}
+
+void buf_clear(struct client_state *state) {
+    state->seg_head = 0;
+    state->seg_count = 0;
 }
 
 void buf_delete_word(struct client_state *state) {
     if (state->seg_count == 0) return;
 
-    // 1. Remove trailing spaces if any (treat sequence of spaces as one unit to delete, or just skip them to get to the word)
     // Standard Ctrl+W/Ctrl+Backspace usually deletes the word AND the trailing space if you are just after a word.
     // If we are at "Hello World ", it deletes "World ".
-    // If we are at "Hello World  ", it might delete just spaces or the word too.
-    // Let's adopt a simple approach: Delete backwards until we find a non-space, then delete until we find a space.
-    
-    // However, our buffer is segmented. We must respect segments to keep `seg_lengths` valid.
-    
-    int deleted_something = 0;
+    // Our buffer is segmented and keys.c adds " " as a separate segment, so:
+    // delete trailing space segments, then delete until the next space segment.
     
     // Step 1: Consume trailing spaces
-    while (state->seg_count > 0) {
-        int last_seg_idx = state->seg_count - 1;
-        int last_len = state->seg_lengths[last_seg_idx];
-        char *last_seg_start = state->display_buf + state->display_len - last_len;
-        
-        // Check if this segment is a space (our keys.c actually adds " " as a separate segment usually)
-        if (strcmp(last_seg_start, " ") == 0) {
-            buf_backspace(state);
-            deleted_something = 1;
-        } else {
-            break; 
-        }
+    while (state->seg_count > 0 && seg_is_space(buf_last(state))) {
+        buf_pop(state);
     }
     
-    // Step 2: Consume the word (non-space segments)
-    while (state->seg_count > 0) {
-        int last_seg_idx = state->seg_count - 1;
-        int last_len = state->seg_lengths[last_seg_idx];
-        char *last_seg_start = state->display_buf + state->display_len - last_len;
-        
-        // If we hit a space, stop
-        if (strcmp(last_seg_start, " ") == 0) {
-            if (!deleted_something) {
-               // If we haven't deleted anything yet (e.g. cursor was right at the space), 
-               // we should technically delete this space and continue? 
-               // Actually, `Ctrl+W` behaving like vim/bash:
-               // "Start " -> "Start" (deletes space)
-               // "Start" -> "" (deletes word)
-               // My logic above in Step 1 handles the "Start " -> "Start" case if there are trailing spaces.
-               // So if we are here, we hit a space *after* deleting some non-space stuff, so we stop.
-            }
-            break;
-        }
-        
-        // Delete this segment
-        buf_backspace(state);
-        deleted_something = 1;
+    // Step 2: Consume the word (non-space segments), stop at a space
+    while (state->seg_count > 0 && !seg_is_space(buf_last(state))) {
+        buf_pop(state);
     }
 }
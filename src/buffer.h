@@ -1,10 +1,39 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <stddef.h>
 #include "state.h"
 
-void buf_append(struct client_state *state, const char *text);
+// Segment `i` counting from the oldest one (0) to the newest (seg_count - 1)
+static inline struct segment *buf_segment(struct client_state *state, int i) {
+    return &state->segments[(state->seg_head + i) & (MAX_SEGMENTS - 1)];
+}
+
+static inline struct segment *buf_last(struct client_state *state) {
+    return state->seg_count > 0 ? buf_segment(state, state->seg_count - 1) : NULL;
+}
+
+// Appends one segment, evicting the oldest when the ring is full. O(1).
+struct segment *buf_append(struct client_state *state, uint8_t mods, xkb_keysym_t keysym, int icon, const char *text);
+// Counts a key into the newest segment when it is the same key again, and
+// returns that segment; NULL means the key needs a segment of its own. Named
+// keys and combos collapse from the second press, plain characters from the
+// third so that ordinary double letters stay as typed.
+struct segment *buf_repeat(struct client_state *state, uint8_t mods, xkb_keysym_t keysym, const char *text);
+// Undoes one key press: a counted segment loses one from its count, anything
+// else is removed
 void buf_backspace(struct client_state *state);
 void buf_delete_word(struct client_state *state);
+void buf_clear(struct client_state *state);
+// Index of the oldest segment such that it and everything after it fit in max_width
+int buf_fit_start(struct client_state *state, double max_width);
+
+// Writes the "Ctrl+Alt+" prefix for a modifier mask, returns its length
+int seg_format_mods(uint8_t mods, char *out, size_t size);
+// Repeat count suffix such as "×23", empty for a single press
+int seg_format_count(const struct segment *seg, char *out, size_t size);
+// Full label including modifiers and count, e.g. "Ctrl+Enter×2"; this is what identifies a
+// segment's pixels
+int seg_format(const struct segment *seg, char *out, size_t size);
 
 #endif
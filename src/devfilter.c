@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <libudev.h>
+#include "devfilter.h"
+
+#define FILTER_MAX_RULES 32
+
+enum rule_kind {
+    RULE_CAPABILITY,
+    RULE_NAME,
+    RULE_PROPERTY,
+};
+
+struct filter_rule {
+    enum rule_kind kind;
+    int deny;
+    const char *const *props; // RULE_CAPABILITY: any of these udev properties set
+    char key[64];             // RULE_PROPERTY
+    char pattern[128];        // RULE_NAME, RULE_PROPERTY
+};
+
+struct device_filter {
+    struct filter_rule rules[FILTER_MAX_RULES];
+    int count;
+    int allow_count;
+};
+
+static const char *const keyboard_props[] = { "ID_INPUT_KEYBOARD", NULL };
+// Anything with keys: also power buttons, lid switches, media remotes, headsets
+static const char *const key_props[] = { "ID_INPUT_KEY", NULL };
+static const char *const pointer_props[] = { "ID_INPUT_MOUSE", "ID_INPUT_TOUCHPAD", "ID_INPUT_POINTINGSTICK", "ID_INPUT_TRACKBALL", NULL };
+static const char *const touchpad_props[] = { "ID_INPUT_TOUCHPAD", NULL };
+static const char *const touchscreen_props[] = { "ID_INPUT_TOUCHSCREEN", NULL };
+static const char *const tablet_props[] = { "ID_INPUT_TABLET", "ID_INPUT_TABLET_PAD", NULL };
+static const char *const joystick_props[] = { "ID_INPUT_JOYSTICK", NULL };
+static const char *const switch_props[] = { "ID_INPUT_SWITCH", NULL };
+
+static const struct {
+    const char *name;
+    const char *const *props;
+} capabilities[] = {
+    { "keyboard", keyboard_props },
+    { "key", key_props },
+    { "pointer", pointer_props },
+    { "touchpad", touchpad_props },
+    { "touchscreen", touchscreen_props },
+    { "tablet", tablet_props },
+    { "joystick", joystick_props },
+    { "switch", switch_props },
+};
+
+static int add_rule(struct device_filter *filter, const char *text) {
+    if (filter->count == FILTER_MAX_RULES) {
+        fprintf(stderr, "Too many device rules (max %d)\n", FILTER_MAX_RULES);
+        return -1;
+    }
+    struct filter_rule *rule = &filter->rules[filter->count];
+    memset(rule, 0, sizeof(*rule));
+    if (*text == '!') {
+        rule->deny = 1;
+        text++;
+    }
+    
+    const char *eq = strchr(text, '=');
+    if (eq) {
+        size_t key_len = eq - text;
+        if (key_len == 0 || key_len >= sizeof(rule->key)) {
+            fprintf(stderr, "Invalid device rule '%s'\n", text);
+            return -1;
+        }
+        memcpy(rule->key, text, key_len);
+        rule->key[key_len] = '\0';
+        snprintf(rule->pattern, sizeof(rule->pattern), "%s", eq + 1);
+        rule->kind = strcmp(rule->key, "name") == 0 ? RULE_NAME : RULE_PROPERTY;
+    } else {
+        for (size_t i = 0; i < sizeof(capabilities) / sizeof(capabilities[0]); i++) {
+            if (strcmp(text, capabilities[i].name) == 0) rule->props = capabilities[i].props;
+        }
+        if (!rule->props) {
+            fprintf(stderr, "Unknown device type '%s'\n", text);
+            return -1;
+        }
+        rule->kind = RULE_CAPABILITY;
+    }
+    
+    filter->count++;
+    if (!rule->deny) filter->allow_count++;
+    return 0;
+}
+
+struct device_filter *device_filter_new(const char *spec, int pointer) {
+    struct device_filter *filter = calloc(1, sizeof(*filter));
+    if (!filter) return NULL;
+    
+    if (spec) {
+        char *copy = strdup(spec);
+        char *save = NULL;
+        for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+            if (add_rule(filter, tok) != 0) {
+                free(copy);
+                free(filter);
+                return NULL;
+            }
+        }
+        free(copy);
+    }
+    
+    if (!filter->allow_count) {
+        if (add_rule(filter, "keyboard") != 0 || (pointer && add_rule(filter, "pointer") != 0)) {
+            free(filter);
+            return NULL;
+        }
+    }
+    return filter;
+}
+
+static int rule_match(const struct filter_rule *rule, struct udev_device *device) {
+    switch (rule->kind) {
+        case RULE_CAPABILITY:
+            for (const char *const *prop = rule->props; *prop; prop++) {
+                const char *value = udev_device_get_property_value(device, *prop);
+                if (value && strcmp(value, "1") == 0) return 1;
+            }
+            return 0;
+        case RULE_NAME: {
+            // The name lives on the parent input device, not the event node
+            struct udev_device *input = udev_device_get_parent_with_subsystem_devtype(device, "input", NULL);
+            const char *name = input ? udev_device_get_sysattr_value(input, "name") : NULL;
+            return name && fnmatch(rule->pattern, name, 0) == 0;
+        }
+        case RULE_PROPERTY: {
+            const char *value = udev_device_get_property_value(device, rule->key);
+            return value && fnmatch(rule->pattern, value, 0) == 0;
+        }
+    }
+    return 0;
+}
+
+int device_filter_match(const struct device_filter *filter, struct udev_device *device) {
+    int allowed = 0;
+    for (int i = 0; i < filter->count; i++) {
+        const struct filter_rule *rule = &filter->rules[i];
+        if (!rule_match(rule, device)) continue;
+        if (rule->deny) return 0;
+        allowed = 1;
+    }
+    return allowed;
+}
+
+void device_filter_free(struct device_filter *filter) {
+    free(filter);
+}
@@ -0,0 +1,22 @@
+#ifndef DEVFILTER_H
+#define DEVFILTER_H
+
+struct udev_device;
+
+// Decides which input devices are opened at all. A spec is a comma-separated
+// list of rules, each optionally prefixed with '!' to deny:
+//   keyboard, key, pointer, touchpad, touchscreen, tablet, joystick, switch
+//                         device capability (udev ID_INPUT_* properties);
+//                         key is any device with keys, e.g. media remotes
+//   name=<glob>           device name, e.g. name=*YubiKey*
+//   <PROPERTY>=<glob>     any udev property, e.g. ID_VENDOR_ID=046d
+// A device is opened if it matches an allow rule and no deny rule. Without
+// allow rules the default applies: keyboards, plus pointers if wanted.
+struct device_filter;
+
+// Returns NULL and prints why if spec doesn't parse. spec may be NULL.
+struct device_filter *device_filter_new(const char *spec, int pointer);
+int device_filter_match(const struct device_filter *filter, struct udev_device *device);
+void device_filter_free(struct device_filter *filter);
+
+#endif
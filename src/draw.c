@@ -1,612 +1,459 @@
 #define _POSIX_C_SOURCE 200809L
 #define _USE_MATH_DEFINES
-#include <unistd.h>
-#include <sys/mman.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <cairo.h>
 #include "draw.h"
 #include "shm.h"
+#include "segcache.h"
+#include "icons.h"
+#include "buffer.h"
+#include "latency.h"
 
-// Helper to separate modifiers from key
-// e.g., "Ctrl+Alt+Enter" -> mods="Ctrl+Alt+", key="Enter"
-static void parse_segment(const char *segment, char *mods, char *key) {
-    mods[0] = '\0';
-    key[0] = '\0';
-    
-    // Find last '+'
-    const char *last_plus = strrchr(segment, '+');
-    if (last_plus) {
-        // Check if the '+' is part of the key name itself?
-        // Our keys.c generates "Ctrl+", "Alt+". The key itself relies on text.
-        // If the key is "+", it would be "Ctrl++". 
-        // strrchr finds the last one.
-        // If key is "+", string is "Ctrl++". last_plus is the second +.
-        // internal key is empty string? No.
-        
-        // Let's rely on the structure from keys.c
-        // It builds "Mod+" then "Key".
-        // If Key is "+", it is "Mod++" or just "+" (no mods).
-        
-        // Simple heuristic: If it ends with +, the key is +.
-        // Wait, if I type +, keys.c says:
-        // combined_buf = "Ctrl+" (if ctrl)
-        // key_str = "+"
-        // segment = "Ctrl++"
-        
-        // If I type "Enter", segment = "Enter" (no plus).
-        // If I type "Ctrl+Enter", segment = "Ctrl+Enter".
-        
-        // If last char is +, then key is +.
-        // "Ctrl++" -> last_plus is at end.
-        
-        size_t len = strlen(segment);
-        if (len > 0 && segment[len-1] == '+') {
-            // Case: "Ctrl++" (Key is +)
-            // Or just "+" (Key is +)
-            // We want to verify if there is a previous part.
-            // Actually, if key is "+", we don't treat it as a SPECIAL icon key anyway.
-            // So we can just fallback to text drawing.
-            strcpy(key, segment);
-            return;
-        }
+// Leave room for glyph overhang and icon strokes around the advance box
+static int segment_pad(const struct client_state *state) {
+    return (int)ceil(state->font_size * 0.2);
+}
 
-        // Normal case "Ctrl+Enter"
-        // last_plus points to before 'Enter'
-        int mod_len = last_plus - segment + 1;
-        strncpy(mods, segment, mod_len);
-        mods[mod_len] = '\0';
-        strcpy(key, last_plus + 1);
+// Rasterize a segment (text, or modifiers followed by an icon) onto its own
+// transparent surface and store it in the segment cache.
+static struct seg_cache_entry *render_segment(struct client_state *state, const struct segment *seg,
+                                              const char *label, const double *color,
+                                              const cairo_font_extents_t *font_extents) {
+    const double icon_size = state->font_size;
+    int is_icon = seg->icon != ICON_NONE;
+    char text[SEG_CACHE_TEXT];
+    char count[16] = "";
+    if (is_icon) {
+        seg_format_mods(seg->mods, text, sizeof(text)); // Only mods before the icon
+        seg_format_count(seg, count, sizeof(count));    // and the repeat count after it
     } else {
-        strcpy(key, segment);
+        snprintf(text, sizeof(text), "%s", label);
     }
+    
+    const double text_w = font_text_width(&state->font, text);
+    double width = text_w + (is_icon ? icon_size + font_text_width(&state->font, count) : 0);
+    
+    const double pad = segment_pad(state);
+    int surf_w = (int)ceil(width + 2 * pad);
+    int surf_h = (int)ceil(font_extents->ascent + font_extents->descent + 2 * pad);
+    if (surf_w < 1) surf_w = 1;
+    
+    struct seg_cache_entry *entry = seg_cache_insert(&state->seg_cache, label, color, state->font_size);
+    entry->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, surf_w, surf_h);
+    entry->origin_x = pad;
+    entry->origin_y = pad + ceil(font_extents->ascent);
+    entry->width = width;
+    
+    cairo_t *scr = cairo_create(entry->surface);
+    cairo_set_source_rgba(scr, color[0], color[1], color[2], color[3]);
+    font_draw(&state->font, scr, entry->origin_x, entry->origin_y, text);
+    if (is_icon) {
+        icon_atlas_ensure(&state->icon_atlas, icon_size);
+        icon_atlas_draw(&state->icon_atlas, scr, seg->icon, entry->origin_x + text_w, entry->origin_y);
+        font_draw(&state->font, scr, entry->origin_x + text_w + icon_size, entry->origin_y, count);
+    }
+    cairo_destroy(scr);
+    
+    return entry;
 }
 
-// Draw specific icons
-static void draw_icon(cairo_t *cr, const char *key_name, double x, double y, double size, const double *color) {
-    cairo_save(cr);
-    cairo_set_source_rgba(cr, color[0], color[1], color[2], color[3]);
-    cairo_set_line_width(cr, size * 0.08);
-    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
-    cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
-
-    if (strcmp(key_name, "Enter") == 0) {
-        // Return symbol ↵
-        // Draw mostly in the em box at x, y (baseline)
-        // Center vertically around y - size/3
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.4;
-        double h = size * 0.3;
-        
-        cairo_move_to(cr, cx + w, cy - h);
-        cairo_line_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx, cy);
-        cairo_line_to(cr, cx - w/2, cy); // Arrow tip line
-        
-        // Arrow head
-        cairo_move_to(cr, cx - w/2 + size*0.1, cy - size*0.1);
-        cairo_line_to(cr, cx - w/2, cy);
-        cairo_line_to(cr, cx - w/2 + size*0.1, cy + size*0.1);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Left") == 0) {
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.3;
-        
-        cairo_move_to(cr, cx + w, cy);
-        cairo_line_to(cr, cx - w, cy);
-        // Head
-        cairo_move_to(cr, cx - w + size*0.15, cy - size*0.15);
-        cairo_line_to(cr, cx - w, cy);
-        cairo_line_to(cr, cx - w + size*0.15, cy + size*0.15);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Right") == 0) {
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.3;
-        
-        cairo_move_to(cr, cx - w, cy);
-        cairo_line_to(cr, cx + w, cy);
-        // Head
-        cairo_move_to(cr, cx + w - size*0.15, cy - size*0.15);
-        cairo_line_to(cr, cx + w, cy);
-        cairo_line_to(cr, cx + w - size*0.15, cy + size*0.15);
-        cairo_stroke(cr);
+static void frame_done(void *data, struct wl_callback *cb, uint32_t time) {
+    (void)time;
+    struct client_state *state = data;
+    wl_callback_destroy(cb);
+    state->frame_cb = NULL;
+    schedule_frame(state);
+}
+static const struct wl_callback_listener frame_listener = { .done = frame_done };
 
-    } else if (strcmp(key_name, "Up") == 0) {
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double h = size * 0.3;
-        
-        cairo_move_to(cr, cx, cy + h);
-        cairo_line_to(cr, cx, cy - h);
-        // Head
-        cairo_move_to(cr, cx - size*0.15, cy - h + size*0.15);
-        cairo_line_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx + size*0.15, cy - h + size*0.15);
-        cairo_stroke(cr);
+// Carried from commit to presentation of a frame that showed a new key
+struct present_trace {
+    struct client_state *state;
+    uint64_t input_usec;
+    uint64_t commit_usec;
+    int first;
+};
 
-    } else if (strcmp(key_name, "Down") == 0) {
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double h = size * 0.3;
-        
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx, cy + h);
-        // Head
-        cairo_move_to(cr, cx - size*0.15, cy + h - size*0.15);
-        cairo_line_to(cr, cx, cy + h);
-        cairo_line_to(cr, cx + size*0.15, cy + h - size*0.15);
-        cairo_stroke(cr);
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *fb, struct wl_output *output) {
+    (void)data; (void)fb; (void)output;
+}
+static void feedback_presented(void *data, struct wp_presentation_feedback *fb,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+                               uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags) {
+    (void)refresh; (void)seq_hi; (void)seq_lo; (void)flags;
+    struct present_trace *trace = data;
+    uint64_t sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo;
+    uint64_t present_usec = sec * 1000000 + tv_nsec / 1000;
+    latency_record(&trace->state->latency, LAT_COMMIT_TO_PRESENT, trace->commit_usec, present_usec);
+    latency_record(&trace->state->latency, LAT_INPUT_TO_PRESENT, trace->input_usec, present_usec);
+    if (trace->first) latency_record(&trace->state->latency, LAT_FIRST_TO_PRESENT, trace->input_usec, present_usec);
+    wp_presentation_feedback_destroy(fb);
+    free(trace);
+}
+static void feedback_discarded(void *data, struct wp_presentation_feedback *fb) {
+    wp_presentation_feedback_destroy(fb);
+    free(data);
+}
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = feedback_presented,
+    .discarded = feedback_discarded,
+};
 
-    } else if (strcmp(key_name, "Tab") == 0) {
-        // Tab icon ->|
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.3;
-        
-        cairo_move_to(cr, cx - w, cy);
-        cairo_line_to(cr, cx + w, cy);
-        // Bar
-        cairo_move_to(cr, cx + w, cy - size*0.15);
-        cairo_line_to(cr, cx + w, cy + size*0.15);
-        // Head
-        cairo_move_to(cr, cx + w - size*0.15, cy - size*0.15);
-        cairo_line_to(cr, cx + w, cy);
-        cairo_line_to(cr, cx + w - size*0.15, cy + size*0.15);
-        cairo_stroke(cr);
+// Close out the pending keystroke mark for a frame about to be committed.
+// Presentation timestamps are only comparable when the compositor uses
+// CLOCK_MONOTONIC, like libinput does.
+static void trace_commit(struct client_state *state, uint64_t render_usec) {
+    struct latency_mark *mark = &state->latency_pending;
+    if (!mark->input_usec) return;
     
-    } else if (strcmp(key_name, "Backspace") == 0 || strcmp(key_name, "BackSpace") == 0) {
-        // Backspace: ⌫ (arrow with X)
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.25;
-        
-        // Arrow pointing left
-        cairo_move_to(cr, cx + w, cy);
-        cairo_line_to(cr, cx - w, cy);
-        cairo_move_to(cr, cx - w + size*0.12, cy - size*0.12);
-        cairo_line_to(cr, cx - w, cy);
-        cairo_line_to(cr, cx - w + size*0.12, cy + size*0.12);
-        
-        // Small X on the right
-        cairo_move_to(cr, cx + w - size*0.1, cy - size*0.08);
-        cairo_line_to(cr, cx + w, cy + size*0.08);
-        cairo_move_to(cr, cx + w, cy - size*0.08);
-        cairo_line_to(cr, cx + w - size*0.1, cy + size*0.08);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Del") == 0 || strcmp(key_name, "Delete") == 0) {
-        // Delete: forward arrow with X
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.25;
-        
-        // Arrow pointing right
-        cairo_move_to(cr, cx - w, cy);
-        cairo_line_to(cr, cx + w, cy);
-        cairo_move_to(cr, cx + w - size*0.12, cy - size*0.12);
-        cairo_line_to(cr, cx + w, cy);
-        cairo_line_to(cr, cx + w - size*0.12, cy + size*0.12);
-        
-        // X on left
-        cairo_move_to(cr, cx - w, cy - size*0.08);
-        cairo_line_to(cr, cx - w + size*0.1, cy + size*0.08);
-        cairo_move_to(cr, cx - w + size*0.1, cy - size*0.08);
-        cairo_line_to(cr, cx - w, cy + size*0.08);
-        cairo_stroke(cr);
-        
-    } else if (strncmp(key_name, "F", 1) == 0 && strlen(key_name) >= 2 && strlen(key_name) <= 3) {
-        // Function keys F1-F12: Draw in rounded box with text
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double box_w = size * 0.45;
-        double box_h = size * 0.35;
-        
-        // Rounded box
-        cairo_set_line_width(cr, size * 0.05);
-        cairo_rectangle(cr, cx - box_w/2, cy - box_h/2, box_w, box_h);
-        cairo_stroke(cr);
-        
-        // Text (will be drawn as regular text, not icon path)
-        // For now, just draw the outline
-        cairo_restore(cr);
-        return; // Let text rendering handle F-key label
-        
-    } else if (strcmp(key_name, "Caps") == 0) {
-        // Caps Lock: A with up arrow
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double h = size * 0.25;
-        
-        // Up arrow above
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx - size*0.1, cy - h + size*0.12);
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx + size*0.1, cy - h + size*0.12);
-        
-        // "A" shape below
-        cairo_move_to(cr, cx - size*0.15, cy + h);
-        cairo_line_to(cr, cx, cy);
-        cairo_line_to(cr, cx + size*0.15, cy + h);
-        cairo_move_to(cr, cx - size*0.08, cy + h*0.4);
-        cairo_line_to(cr, cx + size*0.08, cy + h*0.4);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Home") == 0) {
-        // Home: House icon
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.25;
-        
-        // Roof (triangle)
-        cairo_move_to(cr, cx - w, cy);
-        cairo_line_to(cr, cx, cy - w);
-        cairo_line_to(cr, cx + w, cy);
-        // Base (rectangle)
-        cairo_move_to(cr, cx - w*0.8, cy);
-        cairo_line_to(cr, cx - w*0.8, cy + w);
-        cairo_line_to(cr, cx + w*0.8, cy + w);
-        cairo_line_to(cr, cx + w*0.8, cy);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "End") == 0) {
-        // End: Corner arrow pointing down-right
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.25;
-        
-        // L-shape arrow
-        cairo_move_to(cr, cx - w, cy - w);
-        cairo_line_to(cr, cx - w, cy + w);
-        cairo_line_to(cr, cx + w, cy + w);
-        // Arrow head
-        cairo_move_to(cr, cx + w - size*0.12, cy + w - size*0.12);
-        cairo_line_to(cr, cx + w, cy + w);
-        cairo_move_to(cr, cx + w, cy + w);
-        cairo_line_to(cr, cx + w - size*0.12, cy + w + size*0.12);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "PgUp") == 0) {
-        // Page Up: Double up arrows
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double h = size * 0.15;
-        
-        // First up arrow
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx - size*0.12, cy - h + size*0.12);
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx + size*0.12, cy - h + size*0.12);
-        
-        // Second up arrow below
-        cairo_move_to(cr, cx, cy + h);
-        cairo_line_to(cr, cx - size*0.12, cy + h + size*0.12);
-        cairo_move_to(cr, cx, cy + h);
-        cairo_line_to(cr, cx + size*0.12, cy + h + size*0.12);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "PgDn") == 0) {
-        // Page Down: Double down arrows
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double h = size * 0.15;
-        
-        // First down arrow
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx - size*0.12, cy - h - size*0.12);
-        cairo_move_to(cr, cx, cy - h);
-        cairo_line_to(cr, cx + size*0.12, cy - h - size*0.12);
-        
-        // Second down arrow below
-        cairo_move_to(cr, cx, cy + h);
-        cairo_line_to(cr, cx - size*0.12, cy + h - size*0.12);
-        cairo_move_to(cr, cx, cy + h);
-        cairo_line_to(cr, cx + size*0.12, cy + h - size*0.12);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Esc") == 0) {
-        // Esc: Circle with X
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double r = size * 0.25;
-        
-        cairo_arc(cr, cx, cy, r, 0, 2 * M_PI);
-        cairo_stroke(cr);
-        
-        // X inside
-        cairo_set_line_width(cr, size * 0.06);
-        cairo_move_to(cr, cx - r*0.5, cy - r*0.5);
-        cairo_line_to(cr, cx + r*0.5, cy + r*0.5);
-        cairo_move_to(cr, cx + r*0.5, cy - r*0.5);
-        cairo_line_to(cr, cx - r*0.5, cy + r*0.5);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Play") == 0) {
-        // Play: Triangle
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double w = size * 0.2;
-        
-        cairo_move_to(cr, cx - w, cy - w);
-        cairo_line_to(cr, cx + w, cy);
-        cairo_line_to(cr, cx - w, cy + w);
-        cairo_close_path(cr);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Pause") == 0) {
-        // Pause: Two vertical bars
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        double h = size * 0.3;
-        double w = size * 0.06;
-        
-        cairo_rectangle(cr, cx - size*0.12, cy - h/2, w, h);
-        cairo_rectangle(cr, cx + size*0.06, cy - h/2, w, h);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Vol+") == 0 || strcmp(key_name, "Bri+") == 0) {
-        // Volume/Brightness up: Speaker/sun with +
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        
-        // + symbol
-        cairo_move_to(cr, cx - size*0.15, cy);
-        cairo_line_to(cr, cx + size*0.15, cy);
-        cairo_move_to(cr, cx, cy - size*0.15);
-        cairo_line_to(cr, cx, cy + size*0.15);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Vol-") == 0 || strcmp(key_name, "Bri-") == 0) {
-        // Volume/Brightness down: - symbol
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        
-        cairo_move_to(cr, cx - size*0.2, cy);
-        cairo_line_to(cr, cx + size*0.2, cy);
-        cairo_stroke(cr);
-        
-    } else if (strcmp(key_name, "Mute") == 0) {
-        // Mute: Speaker with X
-        double cx = x + size * 0.5;
-        double cy = y - size * 0.3;
-        
-        // Speaker trapezoid
-        cairo_move_to(cr, cx - size*0.2, cy - size*0.1);
-        cairo_line_to(cr, cx - size*0.05, cy - size*0.2);
-        cairo_line_to(cr, cx - size*0.05, cy + size*0.2);
-        cairo_line_to(cr, cx - size*0.2, cy + size*0.1);
-        cairo_close_path(cr);
-        cairo_stroke(cr);
-        
-        // X through it
-        cairo_move_to(cr, cx + size*0.05, cy - size*0.15);
-        cairo_line_to(cr, cx + size*0.2, cy + size*0.15);
-        cairo_move_to(cr, cx + size*0.2, cy - size*0.15);
-        cairo_line_to(cr, cx + size*0.05, cy + size*0.15);
-        cairo_stroke(cr);
+    uint64_t commit_usec = latency_now_usec();
+    latency_record(&state->latency, LAT_INPUT_TO_HANDLE, mark->input_usec, mark->handled_usec);
+    latency_record(&state->latency, LAT_HANDLE_TO_APPEND, mark->handled_usec, mark->appended_usec);
+    latency_record(&state->latency, LAT_APPEND_TO_RENDER, mark->appended_usec, render_usec);
+    latency_record(&state->latency, LAT_RENDER, render_usec, commit_usec);
+    latency_record(&state->latency, LAT_INPUT_TO_COMMIT, mark->input_usec, commit_usec);
+    if (mark->first) latency_record(&state->latency, LAT_FIRST_TO_COMMIT, mark->input_usec, commit_usec);
+    
+    if (state->presentation && state->presentation_clock == CLOCK_MONOTONIC) {
+        struct present_trace *trace = malloc(sizeof(*trace));
+        if (trace) {
+            trace->state = state;
+            trace->input_usec = mark->input_usec;
+            trace->commit_usec = commit_usec;
+            trace->first = mark->first;
+            struct wp_presentation_feedback *fb = wp_presentation_feedback(state->presentation, state->surface);
+            wp_presentation_feedback_add_listener(fb, &feedback_listener, trace);
+        }
     }
+    *mark = (struct latency_mark){0};
+}
 
-    cairo_restore(cr);
+static void buffer_released(void *data) {
+    schedule_frame(data);
 }
 
-static int is_icon_key(const char *key) {
-    // Check exact matches
-    if (strcmp(key, "Enter") == 0 ||
-        strcmp(key, "Left") == 0 ||
-        strcmp(key, "Right") == 0 ||
-        strcmp(key, "Up") == 0 ||
-        strcmp(key, "Down") == 0 ||
-        strcmp(key, "Tab") == 0 ||
-        strcmp(key, "Backspace") == 0 ||
-        strcmp(key, "BackSpace") == 0 ||
-        strcmp(key, "Del") == 0 ||
-        strcmp(key, "Delete") == 0 ||
-        strcmp(key, "Caps") == 0 ||
-        strcmp(key, "Home") == 0 ||
-        strcmp(key, "End") == 0 ||
-        strcmp(key, "PgUp") == 0 ||
-        strcmp(key, "PgDn") == 0 ||
-        strcmp(key, "Play") == 0 ||
-        strcmp(key, "Pause") == 0 ||
-        strcmp(key, "Prev") == 0 ||
-        strcmp(key, "Next") == 0 ||
-        strcmp(key, "Vol+") == 0 ||
-        strcmp(key, "Vol-") == 0 ||
-        strcmp(key, "Bri+") == 0 ||
-        strcmp(key, "Bri-") == 0 ||
-        strcmp(key, "Mute") == 0) {
-        return 1;
-    }
+void schedule_frame(struct client_state *state) {
+    // While a frame callback is outstanding the compositor hasn't shown our last
+    // frame yet; frame_done() picks up whatever is dirty by then.
+    if (!state->needs_redraw || !state->window_visible || state->frame_cb) return;
+    if (redraw(state) == 0) state->needs_redraw = 0;
+    wl_display_flush(state->display);
+}
+
+double measure_segment(struct client_state *state, const struct segment *seg) {
+    font_set_size(&state->font, state->font_size);
     
-    // Check F-keys (F1-F12)
-    if (key[0] == 'F' && strlen(key) >= 2 && strlen(key) <= 3) {
-        // Could be F1-F12
-        int fnum = atoi(key + 1);
-        if (fnum >= 1 && fnum <= 12) {
-            return 1;
-        }
+    char text[SEG_CACHE_TEXT];
+    double width = 0;
+    if (seg->icon != ICON_NONE) {
+        seg_format_mods(seg->mods, text, sizeof(text));
+        width += font_text_width(&state->font, text) + state->font_size; // Icon width
+        seg_format_count(seg, text, sizeof(text));
+    } else {
+        seg_format(seg, text, sizeof(text));
     }
-    
-    return 0;
+    width += font_text_width(&state->font, text);
+    // Pen positions are snapped to whole pixels so that every surviving
+    // segment moves by exactly the same dx when a new one is appended
+    return round(width);
+}
+
+static const double *segment_color(const struct client_state *state, int combo) {
+    return combo ? state->current_combo_color : state->text_color;
 }
 
-void redraw(struct client_state *state) {
-    if (!state->surface || !state->window_visible) return;
+static struct seg_cache_entry *get_segment(struct client_state *state, int seg_index, int combo,
+                                           const cairo_font_extents_t *font_extents) {
+    const struct segment *seg = buf_segment(state, seg_index);
+    char label[SEG_CACHE_TEXT];
+    seg_format(seg, label, sizeof(label));
+    const double *color = segment_color(state, combo);
+    struct seg_cache_entry *entry = seg_cache_lookup(&state->seg_cache, label, color, state->font_size);
+    if (!entry) entry = render_segment(state, seg, label, color, font_extents);
+    return entry;
+}
 
-    const int stride = state->width * 4;
-    const size_t size = stride * state->height;
+// Segments are right-aligned; buf_fit_start() tells how far back from the
+// newest one they still fit, and the cached widths give every pen position.
+static void layout_segments(struct client_state *state, const cairo_font_extents_t *font_extents,
+                            double y_pos, struct frame_layout *layout) {
+    const double max_width = state->width - PADDING - RIGHT_PADDING;
+    const double right_x = state->width - RIGHT_PADDING;
+    const int pad = segment_pad(state);
     
-    int fd = allocate_shm_file(size);
-    if (fd == -1) return;
+    layout->width = state->width;
+    layout->height = state->height;
+    layout->format = state->pool.format;
+    layout->font_size = state->font_size;
+    layout->pad = pad;
+    layout->band_y0 = (int)round(y_pos) - pad - (int)ceil(font_extents->ascent);
+    layout->band_y1 = layout->band_y0 + (int)ceil(font_extents->ascent + font_extents->descent + 2 * pad);
+    if (layout->band_y0 < 0) layout->band_y0 = 0;
+    if (layout->band_y1 > state->height) layout->band_y1 = state->height;
+    layout->mouse = state->mouse.lmb || state->mouse.rmb || state->mouse.mmb;
+    layout->count = 0;
     
-    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED) { close(fd); return; }
+    if (state->seg_count == 0) return;
+    const int start_seg = buf_fit_start(state, max_width);
+    const double end = buf_last(state)->end;
+    for (int i = state->seg_count - 1; i >= start_seg; i--) {
+        const struct segment *seg = buf_segment(state, i);
+        struct frame_item *item = &layout->items[layout->count++];
+        item->id = seg->id;
+        item->x = (int)(right_x - (end - seg->end + seg->width));
+        item->width = seg->width;
+        item->seg = i;
+        // Use combo color for the LAST segment if use_combo_color is set
+        item->combo = (i == state->seg_count - 1 && state->use_combo_color);
+    }
+}
+
+// Blit every laid out segment that intersects [x0, x1); the caller clips
+static void paint_segments(struct client_state *state, cairo_t *cr, const struct frame_layout *layout,
+                           const cairo_font_extents_t *font_extents, double y_pos, int x0, int x1) {
+    for (int i = 0; i < layout->count; i++) {
+        const struct frame_item *item = &layout->items[i];
+        if (item->x + item->width + layout->pad <= x0 || item->x - layout->pad >= x1) continue;
+        struct seg_cache_entry *entry = get_segment(state, item->seg, item->combo, font_extents);
+        cairo_set_source_surface(cr, entry->surface, item->x - entry->origin_x, round(y_pos) - entry->origin_y);
+        cairo_paint(cr);
+    }
+}
+
+static void draw_mouse_info(struct client_state *state, cairo_t *cr) {
+    char mouse_info[128];
+    char buttons[32] = "";
     
-    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, size);
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, 
-        state->width, state->height, stride, WL_SHM_FORMAT_ARGB8888);
-    wl_shm_pool_destroy(pool);
-    close(fd);
+    if (state->mouse.lmb) strcat(buttons, "LMB ");
+    if (state->mouse.rmb) strcat(buttons, "RMB ");
+    if (state->mouse.mmb) strcat(buttons, "MMB ");
     
-    cairo_surface_t *cs = cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32, state->width, state->height, stride);
-    cairo_t *cr = cairo_create(cs);
+    snprintf(mouse_info, sizeof(mouse_info), "%s (%d, %d)", buttons, state->mouse.x, state->mouse.y);
     
-    // Clear
-    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.0);
-    cairo_paint(cr);
-    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_set_source_rgba(cr, state->text_color[0], state->text_color[1], state->text_color[2], state->text_color[3]);
+    font_set_size(&state->mouse_font, state->font_size * 0.5); // Smaller text for mouse
     
-    // Background
-    const double r = 0;
-    cairo_new_sub_path(cr);
-    cairo_arc(cr, state->width - r, r, r, -M_PI/2, 0);
-    cairo_arc(cr, state->width - r, state->height - r, r, 0, M_PI/2);
-    cairo_arc(cr, r, state->height - r, r, M_PI/2, M_PI);
-    cairo_arc(cr, r, r, r, M_PI, 3*M_PI/2);
-    cairo_close_path(cr);
-    cairo_set_source_rgba(cr, state->bg_color[0], state->bg_color[1], state->bg_color[2], state->bg_color[3]);
-    cairo_fill(cr);
+    double mouse_x = (state->width - font_text_width(&state->mouse_font, mouse_info)) / 2.0; // Center
+    double mouse_y = state->height - 10;
     
-    // Font setup
-    cairo_select_font_face(cr, "Monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size(cr, state->font_size);
-    cairo_set_source_rgba(cr, state->text_color[0], state->text_color[1], state->text_color[2], state->text_color[3]);
+    font_draw(&state->mouse_font, cr, mouse_x, mouse_y, mouse_info);
+}
 
-    cairo_font_extents_t font_extents;
-    cairo_font_extents(cr, &font_extents);
+// Find the longest run of segments that kept their identity and colour since
+// the previous frame and all moved by the same dx; that run can be scrolled
+// instead of repainted. Returns 0 if there is nothing worth reusing.
+static int find_scroll(const struct frame_layout *prev, const struct frame_layout *cur,
+                       int *dx, int *first, int *last) {
+    // Both lists are sorted newest (highest id) first, so advance whichever
+    // side holds the newer segment until the two meet
+    int j = 0, k = 0;
+    while (j < cur->count && k < prev->count) {
+        const struct frame_item *a = &cur->items[j], *b = &prev->items[k];
+        if (a->id > b->id) { j++; continue; }
+        if (a->id < b->id) { k++; continue; }
+        if (a->combo != b->combo) { j++; k++; continue; } // Recoloured, must repaint
+        break;
+    }
+    if (j >= cur->count || k >= prev->count) return 0;
     
-    const double icon_size = state->font_size;
-    const double max_width = state->width - PADDING - RIGHT_PADDING;
-    const double y_pos = (state->height - font_extents.height) / 2.0 + font_extents.ascent + TOP_BOTTOM_PADDING - 7.0;
+    *dx = cur->items[j].x - prev->items[k].x;
+    *first = j;
+    while (j < cur->count && k < prev->count &&
+           cur->items[j].id == prev->items[k].id &&
+           cur->items[j].combo == prev->items[k].combo &&
+           cur->items[j].x - prev->items[k].x == *dx) {
+        *last = j;
+        j++;
+        k++;
+    }
+    return *last >= *first;
+}
+
+struct damage_rect { int x0, x1; };
 
-    // Measurement & Logic Phase:
-    // Determine which segments fit from the end.
+// Horizontal extent of every bitmap in both frames, clamped to the buffer
+static struct damage_rect layout_extent(const struct frame_layout *prev, const struct frame_layout *cur) {
+    struct damage_rect r = { cur->width, 0 };
+    const struct frame_layout *frames[2] = { prev, cur };
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < frames[f]->count; i++) {
+            const struct frame_item *item = &frames[f]->items[i];
+            int x0 = item->x - frames[f]->pad;
+            int x1 = (int)ceil(item->x + item->width) + frames[f]->pad;
+            if (x0 < r.x0) r.x0 = x0;
+            if (x1 > r.x1) r.x1 = x1;
+        }
+    }
+    if (r.x0 < 0) r.x0 = 0;
+    if (r.x1 > cur->width) r.x1 = cur->width;
+    return r;
+}
+
+// Offscreen rendering (bench.c) has no surface to post damage to
+static void damage_buffer(struct client_state *state, int x, int y, int width, int height) {
+    if (state->surface) wl_surface_damage_buffer(state->surface, x, y, width, height);
+}
+
+static void paint_band(struct client_state *state, cairo_t *cr, const struct frame_layout *layout,
+                       const cairo_font_extents_t *font_extents, double y_pos, int x0, int x1) {
+    if (x1 <= x0) return;
+    cairo_save(cr);
+    cairo_rectangle(cr, x0, layout->band_y0, x1 - x0, layout->band_y1 - layout->band_y0);
+    cairo_clip(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_rgba(cr, state->bg_color[0], state->bg_color[1], state->bg_color[2], state->bg_color[3]);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    paint_segments(state, cr, layout, font_extents, y_pos, x0, x1);
+    cairo_restore(cr);
+    damage_buffer(state, x0, layout->band_y0, x1 - x0, layout->band_y1 - layout->band_y0);
+}
+
+// Reuse the previous frame: bring its pixels into `buffer`, shift the run of
+// surviving segments by dx and repaint only the strips on either side of it.
+// Returns 0 if the frame could not be derived incrementally.
+static int redraw_incremental(struct client_state *state, cairo_t *cr, struct shm_buffer *buffer,
+                              const struct frame_layout *cur, const cairo_font_extents_t *font_extents, double y_pos) {
+    const struct frame_layout *prev = &state->last_frame;
+    if (!prev->valid || !prev->buffer || prev->mouse || cur->mouse ||
+        prev->width != cur->width || prev->height != cur->height || prev->format != cur->format ||
+        prev->font_size != cur->font_size ||
+        prev->band_y0 != cur->band_y0 || prev->band_y1 != cur->band_y1) return 0;
     
+    // Everything outside [dst_x0, dst_x1) that either frame drew on is stale
+    struct damage_rect extent = layout_extent(prev, cur);
+    int dx = 0, first = 0, last = -1;
+    int dst_x0 = extent.x1, dst_x1 = extent.x1;
+    if (find_scroll(prev, cur, &dx, &first, &last)) {
+        // Neighbouring bitmaps may overhang by up to pad pixels into the run
+        const int pad = cur->pad;
+        dst_x0 = cur->items[last].x + pad;
+        dst_x1 = (int)floor(cur->items[first].x + cur->items[first].width) - pad;
+        if (dst_x1 <= dst_x0 || dst_x0 < 0 || dst_x1 > cur->width ||
+            dst_x0 - dx < 0 || dst_x1 - dx > cur->width) return 0;
+    } else if (prev->count) {
+        return 0;
+    } // else the previous frame is bare background (see window_park), paint onto it
     
-    int start_seg = 0;
-    double seg_widths[MAX_SEGMENTS];
-    int seg_is_icon[MAX_SEGMENTS]; // 1 if key part is icon
-    char seg_keys[MAX_SEGMENTS][32]; // Store key name if icon
-    char seg_mods[MAX_SEGMENTS][64]; // Text part (modifiers or full text)
+    const int src_x0 = dst_x0 - dx;
     
-    // First pass: Measure all segments
-    int current_char_idx = 0;
-    for (int i = 0; i < state->seg_count; i++) {
-        int len = state->seg_lengths[i];
-        char snippet[128];
-        snprintf(snippet, sizeof(snippet), "%.*s", len, state->display_buf + current_char_idx);
-        current_char_idx += len;
-        
-        char mods[64], key[32];
-        parse_segment(snippet, mods, key);
-        
-        cairo_text_extents_t mod_extents;
-        cairo_text_extents(cr, mods, &mod_extents);
-        
-        double w = mod_extents.x_advance;
-        
-        if (is_icon_key(key)) {
-            seg_is_icon[i] = 1;
-            strcpy(seg_keys[i], key);
-            w += icon_size; // Icon width
-        } else {
-            seg_is_icon[i] = 0;
-            cairo_text_extents_t key_extents;
-            cairo_text_extents(cr, key, &key_extents);
-            w += key_extents.x_advance;
-            // Reconstruct full text for drawing if not icon
-            snprintf(seg_mods[i], sizeof(seg_mods[i]), "%s%s", mods, key); // Stored in seg_mods for convenience
-        }
-        
-        if (seg_is_icon[i]) {
-            strcpy(seg_mods[i], mods); // Only mods needed
+    const int stride = cairo_image_surface_get_stride(buffer->surface);
+    cairo_surface_flush(buffer->surface);
+    if (buffer != prev->buffer) {
+        memcpy(buffer->data, prev->buffer->data, (size_t)stride * cur->height);
+    }
+    if (dx != 0) {
+        for (int y = cur->band_y0; y < cur->band_y1; y++) {
+            char *row = (char *)buffer->data + (size_t)y * stride;
+            memmove(row + dst_x0 * 4, row + src_x0 * 4, (size_t)(dst_x1 - dst_x0) * 4);
         }
-        
-        seg_widths[i] = w;
     }
+    cairo_surface_mark_dirty(buffer->surface);
     
-    // Calculate fit from end
-    double width_so_far = 0;
-    for (int i = state->seg_count - 1; i >= 0; i--) {
-        if (width_so_far + seg_widths[i] > max_width) {
-            start_seg = i + 1;
-            break;
-        }
-        width_so_far += seg_widths[i];
+    paint_band(state, cr, cur, font_extents, y_pos, extent.x0, dst_x0);
+    paint_band(state, cr, cur, font_extents, y_pos, dst_x1, extent.x1);
+    if (dx != 0) {
+        int moved_x0 = dst_x0 < src_x0 ? dst_x0 : src_x0;
+        int moved_x1 = dst_x1 > dst_x1 - dx ? dst_x1 : dst_x1 - dx;
+        damage_buffer(state, moved_x0, cur->band_y0, moved_x1 - moved_x0, cur->band_y1 - cur->band_y0);
     }
+    return 1;
+}
+
+void draw_frame(struct client_state *state, struct shm_buffer *buffer) {
+    cairo_t *cr = cairo_create(buffer->surface);
     
-    // Draw Phase
-    double current_x = state->width - RIGHT_PADDING - width_so_far; 
-    if (current_x < PADDING) current_x = PADDING; // Should match max_width logic approx
+    // Font setup, a no-op unless the size changed
+    font_set_size(&state->font, state->font_size);
+    const cairo_font_extents_t font_extents = state->font.extents;
     
-    // Use combo color for the LAST segment if use_combo_color is set
-    const double *draw_color = state->text_color;
+    const double y_pos = (state->height - font_extents.height) / 2.0 + font_extents.ascent + TOP_BOTTOM_PADDING - 7.0;
+
+    struct frame_layout layout;
+    layout_segments(state, &font_extents, y_pos, &layout);
     
-    for (int i = start_seg; i < state->seg_count; i++) {
-        // Apply combo color to the last segment only
-        if (i == state->seg_count - 1 && state->use_combo_color) {
-            draw_color = state->current_combo_color;
-            cairo_set_source_rgba(cr, draw_color[0], draw_color[1], draw_color[2], draw_color[3]);
-        } else {
-            cairo_set_source_rgba(cr, state->text_color[0], state->text_color[1], state->text_color[2], state->text_color[3]);
+    if (!redraw_incremental(state, cr, buffer, &layout, &font_extents, y_pos)) {
+        // Clear, unless the opaque background below covers every pixel anyway
+        if (state->bg_color[3] < 1.0) {
+            cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+            cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.0);
+            cairo_paint(cr);
+            cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
         }
         
-        // Draw Mods/Text
-        cairo_move_to(cr, current_x, y_pos);
-        cairo_show_text(cr, seg_mods[i]);
-        
-        cairo_text_extents_t ext;
-        cairo_text_extents(cr, seg_mods[i], &ext);
-        current_x += ext.x_advance;
-        
-        // Draw Icon if needed (use combo color if applicable)
-        if (seg_is_icon[i]) {
-            if (i == state->seg_count - 1 && state->use_combo_color) {
-                draw_icon(cr, seg_keys[i], current_x, y_pos, icon_size, state->current_combo_color);
-            } else {
-                draw_icon(cr, seg_keys[i], current_x, y_pos, icon_size, state->text_color);
-            }
-            current_x += icon_size;
-        }
-    }
-    
-    // Draw mouse click display (bottom of window)
-    if (state->mouse.lmb || state->mouse.rmb || state->mouse.mmb) {
-        char mouse_info[128];
-        char buttons[32] = "";
-        
-        if (state->mouse.lmb) strcat(buttons, "LMB ");
-        if (state->mouse.rmb) strcat(buttons, "RMB ");
-        if (state->mouse.mmb) strcat(buttons, "MMB ");
-        
-        snprintf(mouse_info, sizeof(mouse_info), "%s (%d, %d)", buttons, state->mouse.x, state->mouse.y);
+        // Background
+        const double r = 0;
+        cairo_new_sub_path(cr);
+        cairo_arc(cr, state->width - r, r, r, -M_PI/2, 0);
+        cairo_arc(cr, state->width - r, state->height - r, r, 0, M_PI/2);
+        cairo_arc(cr, r, state->height - r, r, M_PI/2, M_PI);
+        cairo_arc(cr, r, r, r, M_PI, 3*M_PI/2);
+        cairo_close_path(cr);
+        cairo_set_source_rgba(cr, state->bg_color[0], state->bg_color[1], state->bg_color[2], state->bg_color[3]);
+        cairo_fill(cr);
         
-        cairo_set_source_rgba(cr, state->text_color[0], state->text_color[1], state->text_color[2], state->text_color[3]);
-        cairo_select_font_face(cr, "Monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-        cairo_set_font_size(cr, state->font_size * 0.5); // Smaller text for mouse
+        paint_segments(state, cr, &layout, &font_extents, y_pos, 0, state->width);
         
-        cairo_text_extents_t mouse_ext;
-        cairo_text_extents(cr, mouse_info, &mouse_ext);
-        double mouse_x = (state->width - mouse_ext.width) / 2.0; // Center
-        double mouse_y = state->height - 10;
+        // Draw mouse click display (bottom of window)
+        if (layout.mouse) draw_mouse_info(state, cr);
         
-        cairo_move_to(cr, mouse_x, mouse_y);
-        cairo_show_text(cr, mouse_info);
+        damage_buffer(state, 0, 0, state->width, state->height);
     }
 
     cairo_destroy(cr);
-    cairo_surface_destroy(cs);
-    munmap(data, size);
+    cairo_surface_flush(buffer->surface);
     
-    wl_surface_attach(state->surface, buffer, 0, 0);
-    wl_surface_damage_buffer(state->surface, 0, 0, state->width, state->height);
-    wl_surface_commit(state->surface);
+    layout.buffer = buffer;
+    layout.valid = 1;
+    state->last_frame = layout;
+}
+
+uint32_t frame_format(const struct client_state *state) {
+    return state->bg_color[3] >= 1.0 ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+}
+
+void set_opaque(struct client_state *state, int opaque) {
+    if (state->opaque == !!opaque) return;
+    state->opaque = !!opaque;
+    struct wl_region *region = NULL;
+    if (opaque) {
+        region = wl_compositor_create_region(state->compositor);
+        wl_region_add(region, 0, 0, state->width, state->height);
+    }
+    wl_surface_set_opaque_region(state->surface, region);
+    if (region) wl_region_destroy(region);
+}
+
+int redraw(struct client_state *state) {
+    if (!state->surface || !state->window_visible || !state->configured) return 0;
+    const uint64_t render_usec = latency_now_usec();
+
+    state->pool.on_release = buffer_released;
+    state->pool.release_data = state;
+    const uint32_t format = frame_format(state);
+    const int resized = shm_pool_resize(&state->pool, state->shm, state->width, state->height, format);
+    if (resized < 0) return -1;
+    if (resized) state->last_frame.valid = 0; // Its buffer slot now holds a blank surface
+    // The buffer holding the last frame needs nothing copied into it once released
+    struct shm_buffer *buffer = state->last_frame.valid && !state->last_frame.buffer->busy
+                              ? state->last_frame.buffer : shm_pool_acquire(&state->pool);
+    if (!buffer) return -1; // Every buffer is still in use by the compositor, retry later
+
+    draw_frame(state, buffer);
     
-    if (state->buffer) wl_buffer_destroy(state->buffer);
-    state->buffer = buffer;
+    wl_surface_attach(state->surface, buffer->wl_buffer, 0, 0);
+    // Lets the compositor skip whatever is below us, every refresh
+    set_opaque(state, format == WL_SHM_FORMAT_XRGB8888);
+    if (!state->frame_cb) {
+        state->frame_cb = wl_surface_frame(state->surface);
+        wl_callback_add_listener(state->frame_cb, &frame_listener, state);
+    }
+    trace_commit(state, render_usec);
+    wl_surface_commit(state->surface);
+    buffer->busy = 1;
+    return 0;
 }
@@ -3,6 +3,20 @@
 
 #include "state.h"
 
-void redraw(struct client_state *state);
+// Returns 0 when a frame was committed (or nothing to draw), -1 when deferred
+int redraw(struct client_state *state);
+// Paint the current segments into buffer (state->width x state->height),
+// scrolling pixels from the last frame where possible. Needs no Wayland
+// objects; damage is only posted when state->surface is set.
+void draw_frame(struct client_state *state, struct shm_buffer *buffer);
+// Buffer format for state->bg_color: XRGB8888 when the background is fully
+// opaque, so the compositor has no alpha to blend
+uint32_t frame_format(const struct client_state *state);
+// Declare the whole surface opaque (or not); only sent when it changes
+void set_opaque(struct client_state *state, int opaque);
+// Redraw now if dirty and not throttled by a pending frame callback
+void schedule_frame(struct client_state *state);
+// Pixel-snapped advance of a segment as redraw() will lay it out
+double measure_segment(struct client_state *state, const struct segment *seg);
 
 #endif
@@ -0,0 +1,281 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <libudev.h>
+#include <linux/input.h>
+#include "evdev.h"
+#include "devfilter.h"
+
+#define EVDEV_MAX_DEVICES 32
+#define EVDEV_READ_BATCH 64         // input_events per read()
+#define EVDEV_FRAME_MAX 16          // Key/button changes held until SYN_REPORT
+#define EVDEV_MONITOR UINT32_MAX    // epoll tag of the udev monitor
+
+#define LONG_BITS (8 * sizeof(unsigned long))
+#define KEY_LONGS ((KEY_CNT + LONG_BITS - 1) / LONG_BITS)
+
+struct evdev_device {
+    int fd;
+    dev_t devnum;
+    uint16_t number;
+    unsigned int dropped : 1;       // Discarding until the next SYN_REPORT
+    int frame_len;
+    struct input_record frame[EVDEV_FRAME_MAX];
+    int rel_x, rel_y;
+    unsigned long keys[KEY_LONGS];  // Key state as last reported
+};
+
+struct evdev {
+    struct udev_monitor *monitor;   // Hotplug, or NULL
+    const struct device_filter *filter;
+    int epoll_fd;
+    uint16_t next_number;
+    struct evdev_device *devices[EVDEV_MAX_DEVICES];
+};
+
+static int test_bit(const unsigned long *bits, unsigned int bit) {
+    return (bits[bit / LONG_BITS] >> (bit % LONG_BITS)) & 1;
+}
+
+static void set_bit(unsigned long *bits, unsigned int bit, int value) {
+    if (value) bits[bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+    else bits[bit / LONG_BITS] &= ~(1UL << (bit % LONG_BITS));
+}
+
+// Mouse, joystick etc. buttons share EV_KEY with keyboard keys
+static int is_button(unsigned int code) {
+    return (code >= BTN_MISC && code < KEY_OK) || code >= BTN_TRIGGER_HAPPY;
+}
+
+static uint64_t event_usec(const struct input_event *ev) {
+    return (uint64_t)ev->input_event_sec * 1000000 + ev->input_event_usec;
+}
+
+static void evdev_add(struct evdev *evdev, struct udev_device *dev) {
+    const char *sysname = udev_device_get_sysname(dev);
+    const char *node = udev_device_get_devnode(dev);
+    if (!sysname || strncmp(sysname, "event", 5) != 0 || !node) return;
+    if (evdev->filter && !device_filter_match(evdev->filter, dev)) return;
+
+    dev_t devnum = udev_device_get_devnum(dev);
+    int slot = -1;
+    for (int i = 0; i < EVDEV_MAX_DEVICES; i++) {
+        if (!evdev->devices[i]) {
+            if (slot < 0) slot = i;
+        } else if (evdev->devices[i]->devnum == devnum) {
+            return; // Already open
+        }
+    }
+    if (slot < 0) {
+        fprintf(stderr, "Warning: too many input devices, ignoring %s\n", node);
+        return;
+    }
+
+    int fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: can't open %s: %s\n", node, strerror(errno));
+        return;
+    }
+    // Event times on the same clock as everything else
+    int clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+
+    struct evdev_device *device = calloc(1, sizeof(*device));
+    device->fd = fd;
+    device->devnum = devnum;
+    device->number = evdev->next_number++;
+    // Keys already held now aren't reported as presses later
+    ioctl(fd, EVIOCGKEY(sizeof(device->keys)), device->keys);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)slot };
+    if (epoll_ctl(evdev->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        free(device);
+        return;
+    }
+    evdev->devices[slot] = device;
+}
+
+static void evdev_remove(struct evdev *evdev, int slot) {
+    struct evdev_device *device = evdev->devices[slot];
+    epoll_ctl(evdev->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+    close(device->fd);
+    free(device);
+    evdev->devices[slot] = NULL;
+}
+
+static void evdev_hotplug(struct evdev *evdev) {
+    struct udev_device *dev;
+    while ((dev = udev_monitor_receive_device(evdev->monitor))) {
+        const char *action = udev_device_get_action(dev);
+        if (action && strcmp(action, "add") == 0) {
+            evdev_add(evdev, dev);
+        } else if (action && strcmp(action, "remove") == 0) {
+            dev_t devnum = udev_device_get_devnum(dev);
+            for (int i = 0; i < EVDEV_MAX_DEVICES; i++) {
+                if (evdev->devices[i] && evdev->devices[i]->devnum == devnum) evdev_remove(evdev, i);
+            }
+        }
+        udev_device_unref(dev);
+    }
+}
+
+static void emit_key(struct evdev_device *device, unsigned int code, int pressed, uint64_t time_usec,
+                     evdev_handler_t handler, void *data) {
+    struct input_record rec = {
+        .time_usec = time_usec,
+        .type = is_button(code) ? INPUT_RECORD_BUTTON : INPUT_RECORD_KEY,
+        .pressed = pressed,
+        .device = device->number,
+        .code = code,
+    };
+    set_bit(device->keys, code, pressed);
+    handler(data, &rec);
+}
+
+// The kernel dropped events: report whatever changed in the real key state
+static void evdev_resync(struct evdev_device *device, uint64_t time_usec, evdev_handler_t handler, void *data) {
+    unsigned long now[KEY_LONGS] = {0};
+    if (ioctl(device->fd, EVIOCGKEY(sizeof(now)), now) < 0) return;
+
+    // Releases first, so no combination shows up that was never held
+    for (int pressed = 0; pressed <= 1; pressed++) {
+        for (unsigned int code = 0; code < KEY_CNT; code++) {
+            if (test_bit(now, code) == pressed && test_bit(device->keys, code) != pressed) {
+                emit_key(device, code, pressed, time_usec, handler, data);
+            }
+        }
+    }
+}
+
+// Hand on one complete frame: its summed motion, then keys in order
+static void evdev_flush(struct evdev_device *device, uint64_t time_usec, evdev_handler_t handler, void *data) {
+    if (device->rel_x || device->rel_y) {
+        struct input_record rec = {
+            .time_usec = time_usec,
+            .type = INPUT_RECORD_MOTION,
+            .device = device->number,
+            .dx = device->rel_x,
+            .dy = device->rel_y,
+        };
+        handler(data, &rec);
+        device->rel_x = device->rel_y = 0;
+    }
+    for (int i = 0; i < device->frame_len; i++) {
+        const struct input_record *rec = &device->frame[i];
+        emit_key(device, rec->code, rec->pressed, time_usec, handler, data);
+    }
+    device->frame_len = 0;
+}
+
+static void evdev_event(struct evdev_device *device, const struct input_event *ev, evdev_handler_t handler, void *data) {
+    if (ev->type == EV_SYN) {
+        if (ev->code == SYN_DROPPED) {
+            device->dropped = 1;
+            device->frame_len = 0;
+            device->rel_x = device->rel_y = 0;
+        } else if (ev->code == SYN_REPORT) {
+            if (device->dropped) {
+                device->dropped = 0;
+                evdev_resync(device, event_usec(ev), handler, data);
+            } else {
+                evdev_flush(device, event_usec(ev), handler, data);
+            }
+        }
+        return;
+    }
+    if (device->dropped) return;
+
+    if (ev->type == EV_KEY && ev->code < KEY_CNT && ev->value != 2) { // 2 is autorepeat
+        if (device->frame_len == EVDEV_FRAME_MAX) evdev_flush(device, event_usec(ev), handler, data);
+        device->frame[device->frame_len++] = (struct input_record){ .code = ev->code, .pressed = ev->value != 0 };
+    } else if (ev->type == EV_REL) {
+        if (ev->code == REL_X) device->rel_x += ev->value;
+        else if (ev->code == REL_Y) device->rel_y += ev->value;
+    }
+}
+
+struct evdev *evdev_open(struct udev *udev, const struct device_filter *filter) {
+    struct evdev *evdev = calloc(1, sizeof(*evdev));
+    evdev->filter = filter;
+    evdev->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (evdev->epoll_fd < 0) {
+        free(evdev);
+        return NULL;
+    }
+
+    // Subscribe before scanning so nothing plugged in meanwhile is missed
+    evdev->monitor = udev_monitor_new_from_netlink(udev, "udev");
+    if (evdev->monitor) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EVDEV_MONITOR };
+        udev_monitor_filter_add_match_subsystem_devtype(evdev->monitor, "input", NULL);
+        if (udev_monitor_enable_receiving(evdev->monitor) < 0 ||
+            epoll_ctl(evdev->epoll_fd, EPOLL_CTL_ADD, udev_monitor_get_fd(evdev->monitor), &ev) < 0) {
+            evdev->monitor = udev_monitor_unref(evdev->monitor);
+        }
+    }
+    if (!evdev->monitor) fprintf(stderr, "Warning: no input hotplug, only devices present now are read\n");
+
+    struct udev_enumerate *enumerate = udev_enumerate_new(udev);
+    udev_enumerate_add_match_subsystem(enumerate, "input");
+    udev_enumerate_add_match_sysname(enumerate, "event*");
+    udev_enumerate_scan_devices(enumerate);
+    struct udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+        struct udev_device *dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(entry));
+        if (!dev) continue;
+        evdev_add(evdev, dev);
+        udev_device_unref(dev);
+    }
+    udev_enumerate_unref(enumerate);
+    return evdev;
+}
+
+int evdev_get_fd(struct evdev *evdev) {
+    return evdev->epoll_fd;
+}
+
+void evdev_dispatch(struct evdev *evdev, evdev_handler_t handler, void *data) {
+    struct epoll_event ready[EVDEV_MAX_DEVICES + 1];
+    int count = epoll_wait(evdev->epoll_fd, ready, EVDEV_MAX_DEVICES + 1, 0);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t slot = ready[i].data.u32;
+        if (slot == EVDEV_MONITOR) {
+            evdev_hotplug(evdev);
+            continue;
+        }
+        struct evdev_device *device = evdev->devices[slot];
+        if (!device) continue; // Unplugged earlier in this batch
+
+        struct input_event events[EVDEV_READ_BATCH];
+        for (;;) {
+            ssize_t len = read(device->fd, events, sizeof(events));
+            if (len < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) evdev_remove(evdev, slot); // ENODEV once unplugged
+                break;
+            }
+            for (size_t e = 0; e < (size_t)len / sizeof(events[0]); e++) {
+                evdev_event(device, &events[e], handler, data);
+            }
+            if ((size_t)len < sizeof(events)) break; // Drained
+        }
+    }
+}
+
+void evdev_close(struct evdev *evdev) {
+    for (int i = 0; i < EVDEV_MAX_DEVICES; i++) {
+        if (evdev->devices[i]) evdev_remove(evdev, i);
+    }
+    if (evdev->monitor) udev_monitor_unref(evdev->monitor);
+    close(evdev->epoll_fd);
+    free(evdev);
+}
@@ -0,0 +1,27 @@
+#ifndef EVDEV_H
+#define EVDEV_H
+
+#include "input.h"
+
+struct udev;
+struct device_filter;
+
+// Reads /dev/input/event* nodes directly instead of going through libinput.
+// All devices sit behind one epoll fd, each wakeup reads as many input_events
+// per read() as the kernel has queued, and events are only handed on once
+// their SYN_REPORT arrives. After a SYN_DROPPED the key state is re-read from
+// the device and the difference is reported as presses/releases. Motion is
+// raw device deltas, without pointer acceleration.
+struct evdev;
+
+typedef void (*evdev_handler_t)(void *data, const struct input_record *rec);
+
+// Opens every event node the filter allows (all of them if filter is NULL)
+// and keeps following hotplug. filter must outlive the evdev.
+struct evdev *evdev_open(struct udev *udev, const struct device_filter *filter);
+int evdev_get_fd(struct evdev *evdev);
+// Read everything that is ready and pass each completed event to handler
+void evdev_dispatch(struct evdev *evdev, evdev_handler_t handler, void *data);
+void evdev_close(struct evdev *evdev);
+
+#endif
@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "font.h"
+
+// Whether fontconfig gave us one of the families asked for. Generic aliases
+// such as "Monospace" always resolve to some other name, so they match anything.
+static int family_matches(const char *requested, const char *resolved) {
+    static const char *generic[] = { "monospace", "sans", "sans-serif", "serif", "system-ui" };
+    while (*requested) {
+        // The family may be a comma-separated list
+        while (*requested == ' ' || *requested == ',') requested++;
+        size_t len = strcspn(requested, ",");
+        while (len > 0 && requested[len - 1] == ' ') len--;
+        if (len > 0) {
+            if (strlen(resolved) == len && strncasecmp(requested, resolved, len) == 0) return 1;
+            for (size_t i = 0; i < sizeof(generic) / sizeof(generic[0]); i++) {
+                if (strlen(generic[i]) == len && strncasecmp(requested, generic[i], len) == 0) return 1;
+            }
+        }
+        requested += strcspn(requested, ",");
+    }
+    return 0;
+}
+
+int font_init(struct font *font, const char *spec, const struct font *share) {
+    if (!spec) spec = FONT_DEFAULT;
+    *font = (struct font){0};
+    // The default font map is shared and owned by Pango; so is the context
+    // between fonts, each holding a reference
+    font->context = share ? g_object_ref(share->context)
+                          : pango_font_map_create_context(pango_cairo_font_map_get_default());
+    font->desc = pango_font_description_from_string(spec);
+    font->layout = pango_layout_new(font->context);
+
+    // Resolve through fontconfig now rather than on the first key
+    font_set_size(font, 16);
+    PangoFont *loaded = pango_context_load_font(font->context, font->desc);
+    if (!loaded) {
+        fprintf(stderr, "No usable font for '%s'\n", spec);
+        font_destroy(font);
+        return -1;
+    }
+    // Pango falls back to whatever is installed rather than failing
+    const char *requested = pango_font_description_get_family(font->desc);
+    PangoFontDescription *got = pango_font_describe(loaded);
+    const char *resolved = pango_font_description_get_family(got);
+    if (!share && requested && resolved && !family_matches(requested, resolved)) {
+        fprintf(stderr, "Warning: font '%s' not found, using '%s'\n", requested, resolved);
+    }
+    pango_font_description_free(got);
+    g_object_unref(loaded);
+    return 0;
+}
+
+void font_set_weight(struct font *font, PangoWeight weight) {
+    pango_font_description_set_weight(font->desc, weight);
+    font->size = 0; // Metrics change with the weight
+}
+
+void font_set_size(struct font *font, double px) {
+    if (font->size == px) return;
+    font->size = px;
+    pango_font_description_set_absolute_size(font->desc, px * PANGO_SCALE);
+    pango_layout_set_font_description(font->layout, font->desc);
+
+    PangoFontMetrics *metrics = pango_context_get_metrics(font->context, font->desc, NULL);
+    font->extents.ascent = (double)pango_font_metrics_get_ascent(metrics) / PANGO_SCALE;
+    font->extents.descent = (double)pango_font_metrics_get_descent(metrics) / PANGO_SCALE;
+    font->extents.height = (double)pango_font_metrics_get_height(metrics) / PANGO_SCALE;
+    if (font->extents.height <= 0) font->extents.height = font->extents.ascent + font->extents.descent;
+    font->extents.max_x_advance = (double)pango_font_metrics_get_approximate_char_width(metrics) / PANGO_SCALE;
+    font->extents.max_y_advance = 0;
+    pango_font_metrics_unref(metrics);
+}
+
+double font_text_width(struct font *font, const char *text) {
+    if (!text[0]) return 0;
+    PangoRectangle logical;
+    pango_layout_set_text(font->layout, text, -1);
+    pango_layout_get_extents(font->layout, NULL, &logical);
+    return (double)logical.width / PANGO_SCALE;
+}
+
+void font_draw(struct font *font, cairo_t *cr, double x, double y, const char *text) {
+    if (!text[0]) return;
+    pango_layout_set_text(font->layout, text, -1);
+    cairo_move_to(cr, x, y - (double)pango_layout_get_baseline(font->layout) / PANGO_SCALE);
+    pango_cairo_show_layout(cr, font->layout);
+}
+
+void font_destroy(struct font *font) {
+    if (font->layout) g_object_unref(font->layout);
+    if (font->context) g_object_unref(font->context); // Freed with its last font
+    if (font->desc) pango_font_description_free(font->desc);
+    *font = (struct font){0};
+}
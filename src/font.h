@@ -0,0 +1,33 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <cairo.h>
+#include <pango/pangocairo.h>
+
+#define FONT_DEFAULT "Monospace Bold"
+
+// A font resolved once through Pango and kept for the life of the process.
+// All its text goes through one reusable PangoLayout, so characters the family
+// lacks (CJK, emoji, ...) come from fallback fonts instead of boxes.
+struct font {
+    PangoContext *context;
+    PangoLayout *layout;
+    PangoFontDescription *desc;
+    double size;                  // Pixel size the layout and extents are for
+    cairo_font_extents_t extents; // Metrics at that size
+};
+
+// spec is a Pango font description such as "JetBrains Mono Bold"; any size
+// in it is ignored. With share, the font uses share's Pango context instead
+// of creating one, but still gets its own layout. Returns 0 on success.
+int font_init(struct font *font, const char *spec, const struct font *share);
+void font_set_weight(struct font *font, PangoWeight weight);
+// Only re-resolves metrics when px actually changes
+void font_set_size(struct font *font, double px);
+// Advance width of text in pixels
+double font_text_width(struct font *font, const char *text);
+// Draw text with its baseline starting at (x, y) in the current source colour
+void font_draw(struct font *font, cairo_t *cr, double x, double y, const char *text);
+void font_destroy(struct font *font);
+
+#endif
@@ -0,0 +1,412 @@
+#define _POSIX_C_SOURCE 200809L
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+#include "icons.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+enum key_icon icon_for_keysym(xkb_keysym_t keysym) {
+    switch (keysym) {
+        case XKB_KEY_Return:
+        case XKB_KEY_KP_Enter:     return ICON_ENTER;
+        case XKB_KEY_Tab:
+        case XKB_KEY_ISO_Left_Tab: return ICON_TAB;
+        case XKB_KEY_Escape:       return ICON_ESC;
+        case XKB_KEY_Up:           return ICON_UP;
+        case XKB_KEY_Down:         return ICON_DOWN;
+        case XKB_KEY_Left:         return ICON_LEFT;
+        case XKB_KEY_Right:        return ICON_RIGHT;
+        case XKB_KEY_BackSpace:    return ICON_BACKSPACE;
+        case XKB_KEY_Delete:       return ICON_DELETE;
+        case XKB_KEY_Home:         return ICON_HOME;
+        case XKB_KEY_End:          return ICON_END;
+        case XKB_KEY_Prior:        return ICON_PGUP;
+        case XKB_KEY_Next:         return ICON_PGDN;
+        case XKB_KEY_Caps_Lock:    return ICON_CAPS;
+        case XKB_KEY_F1: case XKB_KEY_F2: case XKB_KEY_F3: case XKB_KEY_F4:
+        case XKB_KEY_F5: case XKB_KEY_F6: case XKB_KEY_F7: case XKB_KEY_F8:
+        case XKB_KEY_F9: case XKB_KEY_F10: case XKB_KEY_F11: case XKB_KEY_F12:
+                                   return ICON_FKEY;
+        case XKB_KEY_XF86AudioLowerVolume: return ICON_VOL_DOWN;
+        case XKB_KEY_XF86AudioRaiseVolume: return ICON_VOL_UP;
+        case XKB_KEY_XF86AudioMute:        return ICON_MUTE;
+        case XKB_KEY_XF86MonBrightnessUp:  return ICON_BRI_UP;
+        case XKB_KEY_XF86MonBrightnessDown:return ICON_BRI_DOWN;
+        case XKB_KEY_XF86AudioPlay:        return ICON_PLAY;
+        default: return ICON_NONE;
+    }
+}
+
+// Stroke an icon with the current source. (x, y) is the pen position on the
+// baseline, the icon occupies roughly one em box to the right of it.
+static void draw_icon(cairo_t *cr, enum key_icon icon, double x, double y, double size) {
+    cairo_save(cr);
+    cairo_set_line_width(cr, size * 0.08);
+    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+    cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+
+    if (icon == ICON_ENTER) {
+        // Return symbol ↵
+        // Draw mostly in the em box at x, y (baseline)
+        // Center vertically around y - size/3
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.4;
+        double h = size * 0.3;
+        
+        cairo_move_to(cr, cx + w, cy - h);
+        cairo_line_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx, cy);
+        cairo_line_to(cr, cx - w/2, cy); // Arrow tip line
+        
+        // Arrow head
+        cairo_move_to(cr, cx - w/2 + size*0.1, cy - size*0.1);
+        cairo_line_to(cr, cx - w/2, cy);
+        cairo_line_to(cr, cx - w/2 + size*0.1, cy + size*0.1);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_LEFT) {
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.3;
+        
+        cairo_move_to(cr, cx + w, cy);
+        cairo_line_to(cr, cx - w, cy);
+        // Head
+        cairo_move_to(cr, cx - w + size*0.15, cy - size*0.15);
+        cairo_line_to(cr, cx - w, cy);
+        cairo_line_to(cr, cx - w + size*0.15, cy + size*0.15);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_RIGHT) {
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.3;
+        
+        cairo_move_to(cr, cx - w, cy);
+        cairo_line_to(cr, cx + w, cy);
+        // Head
+        cairo_move_to(cr, cx + w - size*0.15, cy - size*0.15);
+        cairo_line_to(cr, cx + w, cy);
+        cairo_line_to(cr, cx + w - size*0.15, cy + size*0.15);
+        cairo_stroke(cr);
+
+    } else if (icon == ICON_UP) {
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double h = size * 0.3;
+        
+        cairo_move_to(cr, cx, cy + h);
+        cairo_line_to(cr, cx, cy - h);
+        // Head
+        cairo_move_to(cr, cx - size*0.15, cy - h + size*0.15);
+        cairo_line_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx + size*0.15, cy - h + size*0.15);
+        cairo_stroke(cr);
+
+    } else if (icon == ICON_DOWN) {
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double h = size * 0.3;
+        
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx, cy + h);
+        // Head
+        cairo_move_to(cr, cx - size*0.15, cy + h - size*0.15);
+        cairo_line_to(cr, cx, cy + h);
+        cairo_line_to(cr, cx + size*0.15, cy + h - size*0.15);
+        cairo_stroke(cr);
+
+    } else if (icon == ICON_TAB) {
+        // Tab icon ->|
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.3;
+        
+        cairo_move_to(cr, cx - w, cy);
+        cairo_line_to(cr, cx + w, cy);
+        // Bar
+        cairo_move_to(cr, cx + w, cy - size*0.15);
+        cairo_line_to(cr, cx + w, cy + size*0.15);
+        // Head
+        cairo_move_to(cr, cx + w - size*0.15, cy - size*0.15);
+        cairo_line_to(cr, cx + w, cy);
+        cairo_line_to(cr, cx + w - size*0.15, cy + size*0.15);
+        cairo_stroke(cr);
+    
+    } else if (icon == ICON_BACKSPACE) {
+        // Backspace: ⌫ (arrow with X)
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.25;
+        
+        // Arrow pointing left
+        cairo_move_to(cr, cx + w, cy);
+        cairo_line_to(cr, cx - w, cy);
+        cairo_move_to(cr, cx - w + size*0.12, cy - size*0.12);
+        cairo_line_to(cr, cx - w, cy);
+        cairo_line_to(cr, cx - w + size*0.12, cy + size*0.12);
+        
+        // Small X on the right
+        cairo_move_to(cr, cx + w - size*0.1, cy - size*0.08);
+        cairo_line_to(cr, cx + w, cy + size*0.08);
+        cairo_move_to(cr, cx + w, cy - size*0.08);
+        cairo_line_to(cr, cx + w - size*0.1, cy + size*0.08);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_DELETE) {
+        // Delete: forward arrow with X
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.25;
+        
+        // Arrow pointing right
+        cairo_move_to(cr, cx - w, cy);
+        cairo_line_to(cr, cx + w, cy);
+        cairo_move_to(cr, cx + w - size*0.12, cy - size*0.12);
+        cairo_line_to(cr, cx + w, cy);
+        cairo_line_to(cr, cx + w - size*0.12, cy + size*0.12);
+        
+        // X on left
+        cairo_move_to(cr, cx - w, cy - size*0.08);
+        cairo_line_to(cr, cx - w + size*0.1, cy + size*0.08);
+        cairo_move_to(cr, cx - w + size*0.1, cy - size*0.08);
+        cairo_line_to(cr, cx - w, cy + size*0.08);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_FKEY) {
+        // Function keys F1-F12: Draw in rounded box with text
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double box_w = size * 0.45;
+        double box_h = size * 0.35;
+        
+        // Rounded box
+        cairo_set_line_width(cr, size * 0.05);
+        cairo_rectangle(cr, cx - box_w/2, cy - box_h/2, box_w, box_h);
+        cairo_stroke(cr);
+        
+        // Text (will be drawn as regular text, not icon path)
+        // For now, just draw the outline
+        cairo_restore(cr);
+        return; // Let text rendering handle F-key label
+        
+    } else if (icon == ICON_CAPS) {
+        // Caps Lock: A with up arrow
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double h = size * 0.25;
+        
+        // Up arrow above
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx - size*0.1, cy - h + size*0.12);
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx + size*0.1, cy - h + size*0.12);
+        
+        // "A" shape below
+        cairo_move_to(cr, cx - size*0.15, cy + h);
+        cairo_line_to(cr, cx, cy);
+        cairo_line_to(cr, cx + size*0.15, cy + h);
+        cairo_move_to(cr, cx - size*0.08, cy + h*0.4);
+        cairo_line_to(cr, cx + size*0.08, cy + h*0.4);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_HOME) {
+        // Home: House icon
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.25;
+        
+        // Roof (triangle)
+        cairo_move_to(cr, cx - w, cy);
+        cairo_line_to(cr, cx, cy - w);
+        cairo_line_to(cr, cx + w, cy);
+        // Base (rectangle)
+        cairo_move_to(cr, cx - w*0.8, cy);
+        cairo_line_to(cr, cx - w*0.8, cy + w);
+        cairo_line_to(cr, cx + w*0.8, cy + w);
+        cairo_line_to(cr, cx + w*0.8, cy);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_END) {
+        // End: Corner arrow pointing down-right
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.25;
+        
+        // L-shape arrow
+        cairo_move_to(cr, cx - w, cy - w);
+        cairo_line_to(cr, cx - w, cy + w);
+        cairo_line_to(cr, cx + w, cy + w);
+        // Arrow head
+        cairo_move_to(cr, cx + w - size*0.12, cy + w - size*0.12);
+        cairo_line_to(cr, cx + w, cy + w);
+        cairo_move_to(cr, cx + w, cy + w);
+        cairo_line_to(cr, cx + w - size*0.12, cy + w + size*0.12);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_PGUP) {
+        // Page Up: Double up arrows
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double h = size * 0.15;
+        
+        // First up arrow
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx - size*0.12, cy - h + size*0.12);
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx + size*0.12, cy - h + size*0.12);
+        
+        // Second up arrow below
+        cairo_move_to(cr, cx, cy + h);
+        cairo_line_to(cr, cx - size*0.12, cy + h + size*0.12);
+        cairo_move_to(cr, cx, cy + h);
+        cairo_line_to(cr, cx + size*0.12, cy + h + size*0.12);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_PGDN) {
+        // Page Down: Double down arrows
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double h = size * 0.15;
+        
+        // First down arrow
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx - size*0.12, cy - h - size*0.12);
+        cairo_move_to(cr, cx, cy - h);
+        cairo_line_to(cr, cx + size*0.12, cy - h - size*0.12);
+        
+        // Second down arrow below
+        cairo_move_to(cr, cx, cy + h);
+        cairo_line_to(cr, cx - size*0.12, cy + h - size*0.12);
+        cairo_move_to(cr, cx, cy + h);
+        cairo_line_to(cr, cx + size*0.12, cy + h - size*0.12);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_ESC) {
+        // Esc: Circle with X
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double r = size * 0.25;
+        
+        cairo_arc(cr, cx, cy, r, 0, 2 * M_PI);
+        cairo_stroke(cr);
+        
+        // X inside
+        cairo_set_line_width(cr, size * 0.06);
+        cairo_move_to(cr, cx - r*0.5, cy - r*0.5);
+        cairo_line_to(cr, cx + r*0.5, cy + r*0.5);
+        cairo_move_to(cr, cx + r*0.5, cy - r*0.5);
+        cairo_line_to(cr, cx - r*0.5, cy + r*0.5);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_PLAY) {
+        // Play: Triangle
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double w = size * 0.2;
+        
+        cairo_move_to(cr, cx - w, cy - w);
+        cairo_line_to(cr, cx + w, cy);
+        cairo_line_to(cr, cx - w, cy + w);
+        cairo_close_path(cr);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_PAUSE) {
+        // Pause: Two vertical bars
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        double h = size * 0.3;
+        double w = size * 0.06;
+        
+        cairo_rectangle(cr, cx - size*0.12, cy - h/2, w, h);
+        cairo_rectangle(cr, cx + size*0.06, cy - h/2, w, h);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_VOL_UP || icon == ICON_BRI_UP) {
+        // Volume/Brightness up: Speaker/sun with +
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        
+        // + symbol
+        cairo_move_to(cr, cx - size*0.15, cy);
+        cairo_line_to(cr, cx + size*0.15, cy);
+        cairo_move_to(cr, cx, cy - size*0.15);
+        cairo_line_to(cr, cx, cy + size*0.15);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_VOL_DOWN || icon == ICON_BRI_DOWN) {
+        // Volume/Brightness down: - symbol
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        
+        cairo_move_to(cr, cx - size*0.2, cy);
+        cairo_line_to(cr, cx + size*0.2, cy);
+        cairo_stroke(cr);
+        
+    } else if (icon == ICON_MUTE) {
+        // Mute: Speaker with X
+        double cx = x + size * 0.5;
+        double cy = y - size * 0.3;
+        
+        // Speaker trapezoid
+        cairo_move_to(cr, cx - size*0.2, cy - size*0.1);
+        cairo_line_to(cr, cx - size*0.05, cy - size*0.2);
+        cairo_line_to(cr, cx - size*0.05, cy + size*0.2);
+        cairo_line_to(cr, cx - size*0.2, cy + size*0.1);
+        cairo_close_path(cr);
+        cairo_stroke(cr);
+        
+        // X through it
+        cairo_move_to(cr, cx + size*0.05, cy - size*0.15);
+        cairo_line_to(cr, cx + size*0.2, cy + size*0.15);
+        cairo_move_to(cr, cx + size*0.2, cy - size*0.15);
+        cairo_line_to(cr, cx + size*0.05, cy + size*0.15);
+        cairo_stroke(cr);
+    }
+
+    cairo_restore(cr);
+}
+
+void icon_atlas_destroy(struct icon_atlas *atlas) {
+    for (int i = 0; i < ICON_COUNT; i++) {
+        if (atlas->cells[i]) cairo_surface_destroy(atlas->cells[i]);
+    }
+    if (atlas->mask) cairo_surface_destroy(atlas->mask);
+    memset(atlas, 0, sizeof(*atlas));
+}
+
+void icon_atlas_ensure(struct icon_atlas *atlas, double size) {
+    if (atlas->mask && atlas->size == size) return;
+    icon_atlas_destroy(atlas);
+
+    // Icons span about [0, size] horizontally and [-0.65, +0.15] * size around
+    // the baseline; keep a margin for the stroke width.
+    const int margin = (int)ceil(size * 0.1);
+    const int cell = (int)ceil(size) + 2 * margin;
+
+    atlas->size = size;
+    atlas->origin_x = margin;
+    atlas->origin_y = margin + ceil(size * 0.8);
+    atlas->mask = cairo_image_surface_create(CAIRO_FORMAT_A8, cell * ICON_COUNT, cell);
+
+    cairo_t *cr = cairo_create(atlas->mask);
+    cairo_set_source_rgba(cr, 0, 0, 0, 1);
+    for (int i = ICON_NONE + 1; i < ICON_COUNT; i++) {
+        draw_icon(cr, i, cell * i + atlas->origin_x, atlas->origin_y, size);
+    }
+    cairo_destroy(cr);
+    cairo_surface_flush(atlas->mask);
+
+    for (int i = 0; i < ICON_COUNT; i++) {
+        atlas->cells[i] = cairo_surface_create_for_rectangle(atlas->mask, cell * i, 0, cell, cell);
+    }
+}
+
+void icon_atlas_draw(struct icon_atlas *atlas, cairo_t *cr, enum key_icon icon, double x, double y) {
+    if (icon <= ICON_NONE || icon >= ICON_COUNT || !atlas->mask) return;
+    cairo_mask_surface(cr, atlas->cells[icon], round(x - atlas->origin_x), round(y - atlas->origin_y));
+}
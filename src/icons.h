@@ -0,0 +1,53 @@
+#ifndef ICONS_H
+#define ICONS_H
+
+#include <cairo.h>
+#include <xkbcommon/xkbcommon.h>
+
+enum key_icon {
+    ICON_NONE = 0,
+    ICON_ENTER,
+    ICON_LEFT,
+    ICON_RIGHT,
+    ICON_UP,
+    ICON_DOWN,
+    ICON_TAB,
+    ICON_BACKSPACE,
+    ICON_DELETE,
+    ICON_FKEY,
+    ICON_CAPS,
+    ICON_HOME,
+    ICON_END,
+    ICON_PGUP,
+    ICON_PGDN,
+    ICON_ESC,
+    ICON_PLAY,
+    ICON_PAUSE,
+    ICON_VOL_UP,
+    ICON_VOL_DOWN,
+    ICON_BRI_UP,
+    ICON_BRI_DOWN,
+    ICON_MUTE,
+    ICON_COUNT
+};
+
+// Every icon rasterized once into an A8 strip, one square cell per icon.
+// Drawing is a masked fill with the current source colour.
+struct icon_atlas {
+    cairo_surface_t *mask;
+    cairo_surface_t *cells[ICON_COUNT];
+    double size;     // Icon size the atlas was built for
+    double origin_x; // Pen position inside each cell
+    double origin_y;
+};
+
+// Resolved once when a key is processed; ICON_NONE means draw the label as text
+enum key_icon icon_for_keysym(xkb_keysym_t keysym);
+
+// (Re)build the atlas if `size` differs from what it was built for
+void icon_atlas_ensure(struct icon_atlas *atlas, double size);
+// Fill `icon` with the current source, pen at (x, y) on the baseline
+void icon_atlas_draw(struct icon_atlas *atlas, cairo_t *cr, enum key_icon icon, double x, double y);
+void icon_atlas_destroy(struct icon_atlas *atlas);
+
+#endif
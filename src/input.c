@@ -4,22 +4,77 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
 #include <libudev.h>
 #include <libinput.h>
 #include <linux/input.h>
 #include <errno.h>
 #include "input.h"
 #include "state.h"
+#include "window.h"
+#include "recording.h"
+#include "devfilter.h"
+#include "evdev.h"
+#include "latency.h"
+
+#define INPUT_RING_SIZE 1024 // Power of two
+#define REPLAY_BATCH 64       // Events per dispatch when replaying as fast as possible
+
+// Single-producer (capture thread) / single-consumer (main loop) queue
+struct input_ring {
+    struct input_record records[INPUT_RING_SIZE];
+    _Alignas(64) atomic_uint head; // Written by the capture thread only
+    _Alignas(64) atomic_uint tail; // Written by the main thread only
+};
 
 struct input_state {
     struct libinput *li;
+    struct evdev *evdev;  // Reads event nodes itself instead of libinput, or NULL
     struct udev *udev;
+    struct device_filter *filter; // Which devices to open, NULL opens all
     key_handler_t handler;
     void *user_data;
+
+    // Threaded capture
+    pthread_t thread;
+    struct input_ring *ring;
+    int wake_fd;  // eventfd: records queued
+    int stop_fd;  // eventfd: ask the capture thread to exit
+    atomic_uint dropped;
+    unsigned int threaded : 1;
+    atomic_int pointer_enabled; // Read by the capture thread
+    uint16_t next_device;
+
+    // Record/replay
+    struct recording *record;  // Copy of every delivered event, or NULL
+    struct recording *replay;  // Event source instead of libinput, or NULL
+    int replay_fd;             // timerfd (realtime) or eventfd (as fast as possible)
+    struct input_record replay_next;
+    uint64_t replay_first;     // Recorded time of the first event
+    uint64_t replay_base;      // Monotonic time the first event is replayed at
+    unsigned int replay_pending : 1;
+    unsigned int replay_realtime : 1;
 };
 
+// Devices the filter rejects are never opened; libinput just skips them
+static int device_allowed(struct input_state *state, const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISCHR(st.st_mode)) return 0;
+    struct udev_device *device = udev_device_new_from_devnum(state->udev, 'c', st.st_rdev);
+    if (!device) return 0;
+    int allowed = device_filter_match(state->filter, device);
+    udev_device_unref(device);
+    return allowed;
+}
+
 static int open_restricted(const char *path, int flags, void *user_data) {
-    (void)user_data;
+    struct input_state *state = user_data;
+    if (state->filter && !device_allowed(state, path)) return -EACCES;
     int fd = open(path, flags);
     return fd < 0 ? -errno : fd;
 }
@@ -34,22 +89,46 @@ static const struct libinput_interface interface = {
     .close_restricted = close_restricted,
 };
 
-struct input_state *input_init(key_handler_t handler, void *user_data) {
+static struct input_state *input_new(key_handler_t handler, void *user_data) {
     struct input_state *state = calloc(1, sizeof(*state));
     state->handler = handler;
     state->user_data = user_data;
+    state->wake_fd = -1;
+    state->stop_fd = -1;
+    atomic_init(&state->pointer_enabled, 1);
+    return state;
+}
+
+struct input_state *input_init(key_handler_t handler, void *user_data, struct device_filter *filter,
+                               enum input_backend backend) {
+    struct input_state *state = input_new(handler, user_data);
+    state->filter = filter;
 
     state->udev = udev_new();
     if (!state->udev) {
         fprintf(stderr, "Failed to initialize udev\n");
+        device_filter_free(filter);
         free(state);
         return NULL;
     }
 
-    state->li = libinput_udev_create_context(&interface, NULL, state->udev);
+    if (backend == INPUT_BACKEND_EVDEV) {
+        state->evdev = evdev_open(state->udev, filter);
+        if (!state->evdev) {
+            fprintf(stderr, "Failed to initialize evdev input\n");
+            udev_unref(state->udev);
+            device_filter_free(filter);
+            free(state);
+            return NULL;
+        }
+        return state;
+    }
+
+    state->li = libinput_udev_create_context(&interface, state, state->udev);
     if (!state->li) {
         fprintf(stderr, "Failed to initialize libinput\n");
         udev_unref(state->udev);
+        device_filter_free(filter);
         free(state);
         return NULL;
     }
@@ -58,72 +137,366 @@ struct input_state *input_init(key_handler_t handler, void *user_data) {
     return state;
 }
 
+// Number devices in the order we first see events from them
+static uint16_t device_number(struct input_state *state, struct libinput_device *device) {
+    uintptr_t id = (uintptr_t)libinput_device_get_user_data(device);
+    if (!id) {
+        id = ++state->next_device;
+        libinput_device_set_user_data(device, (void *)id);
+    }
+    return (uint16_t)(id - 1);
+}
+
+// Translate a libinput event, returns 0 for events we don't care about
+static int input_translate(struct input_state *state, struct libinput_event *event, struct input_record *rec) {
+    enum libinput_event_type type = libinput_event_get_type(event);
+    if (type == LIBINPUT_EVENT_KEYBOARD_KEY || type == LIBINPUT_EVENT_POINTER_BUTTON ||
+        type == LIBINPUT_EVENT_POINTER_MOTION) {
+        rec->device = device_number(state, libinput_event_get_device(event));
+    }
+
+    if (type == LIBINPUT_EVENT_KEYBOARD_KEY) {
+        struct libinput_event_keyboard *k = libinput_event_get_keyboard_event(event);
+        rec->type = INPUT_RECORD_KEY;
+        rec->code = libinput_event_keyboard_get_key(k);
+        rec->pressed = libinput_event_keyboard_get_key_state(k) == LIBINPUT_KEY_STATE_PRESSED;
+        rec->time_usec = libinput_event_keyboard_get_time_usec(k);
+        return 1;
+    } else if (type == LIBINPUT_EVENT_POINTER_BUTTON) {
+        struct libinput_event_pointer *p = libinput_event_get_pointer_event(event);
+        rec->type = INPUT_RECORD_BUTTON;
+        rec->code = libinput_event_pointer_get_button(p);
+        rec->pressed = libinput_event_pointer_get_button_state(p) == LIBINPUT_BUTTON_STATE_PRESSED;
+        rec->time_usec = libinput_event_pointer_get_time_usec(p);
+        return 1;
+    } else if (type == LIBINPUT_EVENT_POINTER_MOTION) {
+        struct libinput_event_pointer *p = libinput_event_get_pointer_event(event);
+        rec->type = INPUT_RECORD_MOTION;
+        rec->dx = libinput_event_pointer_get_dx(p);
+        rec->dy = libinput_event_pointer_get_dy(p);
+        rec->time_usec = libinput_event_pointer_get_time_usec(p);
+        return 1;
+    }
+    return 0;
+}
+
+// Apply one record on the main thread
+static void input_deliver(struct input_state *state, const struct input_record *rec) {
+    if (rec->type != INPUT_RECORD_KEY && !atomic_load_explicit(&state->pointer_enabled, memory_order_relaxed)) return;
+
+    if (state->record && recording_write(state->record, rec) < 0) {
+        fprintf(stderr, "Warning: failed to write input recording, stopping\n");
+        recording_close(state->record);
+        state->record = NULL;
+    }
+
+    if (rec->type == INPUT_RECORD_KEY) {
+        if (state->handler) {
+            state->handler(state->user_data, rec->code,
+                           rec->pressed ? LIBINPUT_KEY_STATE_PRESSED : LIBINPUT_KEY_STATE_RELEASED,
+                           rec->time_usec);
+        }
+    } else if (rec->type == INPUT_RECORD_BUTTON) {
+        // Update mouse state in client_state
+        struct client_state *client = (struct client_state *)state->user_data;
+        
+        int pressed = rec->pressed;
+        if (rec->code == BTN_LEFT) {
+            client->mouse.lmb = pressed;
+        } else if (rec->code == BTN_RIGHT) {
+            client->mouse.rmb = pressed;
+        } else if (rec->code == BTN_MIDDLE) {
+            client->mouse.mmb = pressed;
+        }
+        
+        if (pressed) {
+            clock_gettime(CLOCK_MONOTONIC, &client->mouse.last_click_time);
+            client->needs_redraw = 1;
+            show_window(client);
+        }
+    } else if (rec->type == INPUT_RECORD_MOTION) {
+        // Position follows every record and is clamped as it goes, so running
+        // into an edge and back ends up where it should. Only the sub-pixel
+        // remainder waits; nothing is redrawn until the next frame anyway.
+        struct client_state *client = (struct client_state *)state->user_data;
+        client->mouse.pending_dx += rec->dx;
+        client->mouse.pending_dy += rec->dy;
+        client->mouse.x += (int)client->mouse.pending_dx;
+        client->mouse.y += (int)client->mouse.pending_dy;
+        client->mouse.pending_dx -= (int)client->mouse.pending_dx;
+        client->mouse.pending_dy -= (int)client->mouse.pending_dy;
+        
+        // Clamp to screen bounds (rough estimate, actual bounds may vary)
+        if (client->mouse.x < 0) client->mouse.x = 0;
+        if (client->mouse.y < 0) client->mouse.y = 0;
+        if (client->mouse.x > 3840) client->mouse.x = 3840; // 4K width
+        if (client->mouse.y > 2160) client->mouse.y = 2160; // 4K height
+    }
+}
+
+static int ring_push(struct input_ring *ring, const struct input_record *rec) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == INPUT_RING_SIZE) return 0; // Full
+    ring->records[head & (INPUT_RING_SIZE - 1)] = *rec;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static int ring_pop(struct input_ring *ring, struct input_record *rec) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == head) return 0; // Empty
+    *rec = ring->records[tail & (INPUT_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+static int input_emit(struct input_state *state, const struct input_record *rec, int to_ring) {
+    if (!to_ring) {
+        input_deliver(state, rec);
+        return 1;
+    }
+    if (ring_push(state->ring, rec)) return 1;
+    atomic_fetch_add_explicit(&state->dropped, 1, memory_order_relaxed);
+    return 0;
+}
+
+// Motion deltas within one read are summed into a single record, flushed
+// before any button or key so the order of everything else is kept
+struct input_batch {
+    struct input_state *state;
+    int to_ring;
+    int emitted;
+    int have_motion;
+    struct input_record motion;
+};
+
+static void batch_add(void *data, const struct input_record *rec) {
+    struct input_batch *batch = data;
+    if (rec->type != INPUT_RECORD_KEY &&
+        !atomic_load_explicit(&batch->state->pointer_enabled, memory_order_relaxed)) return;
+
+    if (rec->type == INPUT_RECORD_MOTION) {
+        if (batch->have_motion && batch->motion.device == rec->device) {
+            batch->motion.dx += rec->dx;
+            batch->motion.dy += rec->dy;
+            batch->motion.time_usec = rec->time_usec;
+            return;
+        }
+        if (batch->have_motion) batch->emitted += input_emit(batch->state, &batch->motion, batch->to_ring);
+        batch->motion = *rec;
+        batch->have_motion = 1;
+        return;
+    }
+    if (batch->have_motion) batch->emitted += input_emit(batch->state, &batch->motion, batch->to_ring);
+    batch->have_motion = 0;
+    batch->emitted += input_emit(batch->state, rec, batch->to_ring);
+}
+
+// Drain everything the backend has queued, either applying it (main loop) or
+// queueing it for the main thread (capture thread). Returns the number of
+// records emitted.
+static int input_read_batch(struct input_state *state, int to_ring) {
+    struct input_batch batch = { .state = state, .to_ring = to_ring };
+    if (state->evdev) {
+        evdev_dispatch(state->evdev, batch_add, &batch);
+    } else {
+        libinput_dispatch(state->li);
+        struct libinput_event *event;
+        while ((event = libinput_get_event(state->li))) {
+            struct input_record rec = {0};
+            if (input_translate(state, event, &rec)) batch_add(&batch, &rec);
+            libinput_event_destroy(event);
+        }
+    }
+    if (batch.have_motion) batch.emitted += input_emit(state, &batch.motion, to_ring);
+    return batch.emitted;
+}
+
+static int input_source_fd(struct input_state *state) {
+    return state->evdev ? evdev_get_fd(state->evdev) : libinput_get_fd(state->li);
+}
+
+// Capture thread: drain the devices as soon as the kernel has events, independent
+// of how busy the main loop is with rendering or the tray
+static void *input_thread(void *data) {
+    struct input_state *state = data;
+    struct pollfd fds[2] = {
+        { .fd = input_source_fd(state), .events = POLLIN },
+        { .fd = state->stop_fd, .events = POLLIN },
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+
+        if (input_read_batch(state, 1)) {
+            uint64_t one = 1;
+            if (write(state->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) break;
+        }
+    }
+    return NULL;
+}
+
+int input_start_thread(struct input_state *state) {
+    if (state->threaded) return 0;
+    if (state->replay) return -1; // Nothing to capture
+
+    state->ring = calloc(1, sizeof(*state->ring));
+    state->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    state->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!state->ring || state->wake_fd < 0 || state->stop_fd < 0) goto fail;
+
+    if (pthread_create(&state->thread, NULL, input_thread, state) != 0) goto fail;
+    state->threaded = 1;
+    return 0;
+
+fail:
+    fprintf(stderr, "Failed to start input thread, reading input on the main loop\n");
+    if (state->wake_fd >= 0) close(state->wake_fd);
+    if (state->stop_fd >= 0) close(state->stop_fd);
+    free(state->ring);
+    state->ring = NULL;
+    state->wake_fd = state->stop_fd = -1;
+    return -1;
+}
+
+int input_record_to(struct input_state *state, const char *path) {
+    struct recording *record = recording_create(path);
+    if (!record) return -1;
+    recording_close(state->record);
+    state->record = record;
+    return 0;
+}
+
+static void replay_advance(struct input_state *state) {
+    int rc = recording_read(state->replay, &state->replay_next);
+    if (rc < 0) fprintf(stderr, "Warning: input recording is truncated or corrupt\n");
+    state->replay_pending = rc > 0;
+}
+
+// Make replay_fd readable when the next event is due
+static void replay_arm(struct input_state *state) {
+    if (!state->replay_pending) {
+        fprintf(stderr, "Replay finished\n");
+        return;
+    }
+    if (state->replay_realtime) {
+        uint64_t due = state->replay_next.time_usec - state->replay_first + state->replay_base;
+        struct itimerspec its = {
+            .it_value = { .tv_sec = due / 1000000, .tv_nsec = (due % 1000000) * 1000 },
+        };
+        timerfd_settime(state->replay_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    } else {
+        uint64_t one = 1;
+        if (write(state->replay_fd, &one, sizeof(one)) < 0) state->replay_pending = 0;
+    }
+}
+
+// Deliver whatever is due, with timestamps moved onto today's clock so the
+// latency stages stay meaningful
+static void replay_dispatch(struct input_state *state) {
+    uint64_t count;
+    if (read(state->replay_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) return;
+
+    uint64_t now = latency_now_usec();
+    int delivered = 0;
+    while (state->replay_pending) {
+        struct input_record rec = state->replay_next;
+        if (state->replay_realtime) {
+            rec.time_usec = rec.time_usec - state->replay_first + state->replay_base;
+            if (rec.time_usec > now) break;
+        } else {
+            if (delivered == REPLAY_BATCH) break;
+            rec.time_usec = now;
+        }
+        input_deliver(state, &rec);
+        delivered++;
+        replay_advance(state);
+    }
+    replay_arm(state);
+}
+
+struct input_state *input_init_replay(key_handler_t handler, void *user_data, const char *path, int realtime) {
+    struct input_state *state = input_new(handler, user_data);
+    state->replay_realtime = realtime;
+
+    state->replay = recording_open(path);
+    if (!state->replay) {
+        fprintf(stderr, "Failed to open input recording %s\n", path);
+        free(state);
+        return NULL;
+    }
+    state->replay_fd = realtime ? timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)
+                                : eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (state->replay_fd < 0) {
+        recording_close(state->replay);
+        free(state);
+        return NULL;
+    }
+
+    replay_advance(state);
+    state->replay_first = state->replay_next.time_usec;
+    state->replay_base = latency_now_usec();
+    replay_arm(state);
+    return state;
+}
+
 void input_destroy(struct input_state *state) {
-    libinput_unref(state->li);
+    recording_close(state->record);
+    if (state->replay) {
+        recording_close(state->replay);
+        close(state->replay_fd);
+        free(state);
+        return;
+    }
+    if (state->threaded) {
+        uint64_t one = 1;
+        if (write(state->stop_fd, &one, sizeof(one)) == sizeof(one)) {
+            pthread_join(state->thread, NULL);
+        }
+        close(state->wake_fd);
+        close(state->stop_fd);
+        free(state->ring);
+    }
+    if (state->evdev) evdev_close(state->evdev);
+    else libinput_unref(state->li);
     udev_unref(state->udev);
+    device_filter_free(state->filter);
     free(state);
 }
 
 int input_get_fd(struct input_state *state) {
-    return libinput_get_fd(state->li);
+    if (state->replay) return state->replay_fd;
+    return state->threaded ? state->wake_fd : input_source_fd(state);
 }
 
 void input_dispatch(struct input_state *state) {
-    libinput_dispatch(state->li);
-    
-    struct libinput_event *event;
-    while ((event = libinput_get_event(state->li))) {
-        enum libinput_event_type type = libinput_event_get_type(event);
+    if (state->replay) {
+        replay_dispatch(state);
+        return;
+    }
+    if (state->threaded) {
+        uint64_t count;
+        if (read(state->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) return;
         
-        if (type == LIBINPUT_EVENT_KEYBOARD_KEY) {
-            struct libinput_event_keyboard *k = libinput_event_get_keyboard_event(event);
-            uint32_t key = libinput_event_keyboard_get_key(k);
-            uint32_t key_state = libinput_event_keyboard_get_key_state(k);
-            
-            if (state->handler) {
-                state->handler(state->user_data, key, key_state);
-            }
-        } else if (type == LIBINPUT_EVENT_POINTER_BUTTON) {
-            // Mouse button events
-            struct libinput_event_pointer *p = libinput_event_get_pointer_event(event);
-            uint32_t button = libinput_event_pointer_get_button(p);
-            uint32_t button_state = libinput_event_pointer_get_button_state(p);
-            
-            // Update mouse state in client_state
-            struct client_state *client = (struct client_state *)state->user_data;
-            
-            int pressed = (button_state == LIBINPUT_BUTTON_STATE_PRESSED);
-            if (button == BTN_LEFT) {
-                client->mouse.lmb = pressed;
-            } else if (button == BTN_RIGHT) {
-                client->mouse.rmb = pressed;
-            } else if (button == BTN_MIDDLE) {
-                client->mouse.mmb = pressed;
-            }
-            
-            if (pressed) {
-                clock_gettime(CLOCK_MONOTONIC, &client->mouse.last_click_time);
-                client->needs_redraw = 1;
-                client->window_visible = 1;
-            }
-        } else if (type == LIBINPUT_EVENT_POINTER_MOTION) {
-            // Mouse motion events - track position
-            struct libinput_event_pointer *p = libinput_event_get_pointer_event(event);
-            struct client_state *client = (struct client_state *)state->user_data;
-            
-            // Get delta and update position
-            double dx = libinput_event_pointer_get_dx(p);
-            double dy = libinput_event_pointer_get_dy(p);
-            client->mouse.x += (int)dx;
-            client->mouse.y += (int)dy;
-            
-            // Clamp to screen bounds (rough estimate, actual bounds may vary)
-            if (client->mouse.x < 0) client->mouse.x = 0;
-            if (client->mouse.y < 0) client->mouse.y = 0;
-            if (client->mouse.x > 3840) client->mouse.x = 3840; // 4K width
-            if (client->mouse.y > 2160) client->mouse.y = 2160; // 4K height
+        struct input_record rec;
+        while (ring_pop(state->ring, &rec)) {
+            input_deliver(state, &rec);
         }
         
-        libinput_event_destroy(event);
+        unsigned int dropped = atomic_exchange_explicit(&state->dropped, 0, memory_order_relaxed);
+        if (dropped) fprintf(stderr, "Warning: input queue full, dropped %u events\n", dropped);
+        return;
     }
+
+    input_read_batch(state, 0);
+}
+
+void input_set_pointer(struct input_state *state, int enabled) {
+    atomic_store_explicit(&state->pointer_enabled, enabled, memory_order_relaxed);
 }
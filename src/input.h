@@ -1,15 +1,52 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdint.h>
 #include <libinput.h>
 
 struct input_state;
+struct device_filter;
 
-typedef void (*key_handler_t)(void *data, uint32_t key, uint32_t state);
+// time_usec is the kernel event time (CLOCK_MONOTONIC)
+typedef void (*key_handler_t)(void *data, uint32_t key, uint32_t state, uint64_t time_usec);
 
-struct input_state *input_init(key_handler_t handler, void *user_data);
+enum input_record_type {
+    INPUT_RECORD_KEY,
+    INPUT_RECORD_BUTTON,
+    INPUT_RECORD_MOTION,
+};
+
+// Compact copy of an input event, safe to hand between threads
+struct input_record {
+    uint64_t time_usec; // Kernel event time (CLOCK_MONOTONIC)
+    uint8_t type;       // enum input_record_type
+    uint8_t pressed;    // Key/button state
+    uint16_t device;    // Small per-session device number
+    uint32_t code;      // Key or button code
+    float dx, dy;       // Relative motion
+};
+
+enum input_backend {
+    INPUT_BACKEND_LIBINPUT,
+    INPUT_BACKEND_EVDEV,    // Raw event nodes, see evdev.h
+};
+
+// Takes ownership of filter (see devfilter.h); NULL opens every device on the seat
+struct input_state *input_init(key_handler_t handler, void *user_data, struct device_filter *filter,
+                               enum input_backend backend);
+// Move device reading onto a dedicated thread; input_get_fd() then returns
+// an eventfd that becomes readable when records are queued. Returns 0 on success.
+int input_start_thread(struct input_state *state);
+// Deliver events from a file written by input_record_to() instead of opening
+// any input devices. With realtime the original spacing between events is
+// kept, otherwise they are fed as fast as the main loop takes them.
+struct input_state *input_init_replay(key_handler_t handler, void *user_data, const char *path, int realtime);
+// Append every event delivered from now on to path. Returns 0 on success.
+int input_record_to(struct input_state *state, const char *path);
 void input_destroy(struct input_state *state);
 int input_get_fd(struct input_state *state);
 void input_dispatch(struct input_state *state);
+// Drop pointer buttons and motion as early as possible when nothing shows them
+void input_set_pointer(struct input_state *state, int enabled);
 
 #endif
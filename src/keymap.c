@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include "keymap.h"
+#include "keys.h"
+
+// FNV-1a, 64 bit
+static uint64_t hash_text(const char *text, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static gchar *cache_dir(void) {
+    gchar *dir = g_build_filename(g_get_user_cache_dir(), "keypop", NULL);
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        g_free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+static gchar *cache_path(const gchar *dir, uint64_t hash) {
+    gchar *name = g_strdup_printf("keymap-%016llx.xkb", (unsigned long long)hash);
+    gchar *path = g_build_filename(dir, name, NULL);
+    g_free(name);
+    return path;
+}
+
+static struct xkb_keymap *cache_load(struct xkb_context *ctx, const gchar *dir, uint64_t hash) {
+    gchar *path = cache_path(dir, hash);
+    gchar *text = NULL;
+    gsize len = 0;
+    struct xkb_keymap *keymap = NULL;
+    if (g_file_get_contents(path, &text, &len, NULL)) {
+        keymap = xkb_keymap_new_from_buffer(ctx, text, len, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        g_free(text);
+    }
+    g_free(path);
+    return keymap;
+}
+
+// Store the compiled keymap under hash
+static void cache_store(struct xkb_keymap *keymap, const gchar *dir, uint64_t hash) {
+    gchar *path = cache_path(dir, hash);
+    if (access(path, F_OK) != 0) {
+        char *text = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+        if (text) {
+            g_file_set_contents(path, text, -1, NULL);
+            free(text);
+        }
+    }
+    g_free(path);
+}
+
+// Identifies the keymap xkb_keymap_new_from_names(ctx, NULL, ...) would build
+static uint64_t names_hash(void) {
+    static const char *vars[] = {
+        "XKB_DEFAULT_RULES", "XKB_DEFAULT_MODEL", "XKB_DEFAULT_LAYOUT",
+        "XKB_DEFAULT_VARIANT", "XKB_DEFAULT_OPTIONS",
+    };
+    char key[512];
+    int len = snprintf(key, sizeof(key), "rmlvo");
+    for (size_t i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+        const char *value = getenv(vars[i]);
+        len += snprintf(key + len, sizeof(key) - len, ":%s", value ? value : "");
+        if (len >= (int)sizeof(key)) len = sizeof(key) - 1;
+    }
+    return hash_text(key, len);
+}
+
+struct xkb_keymap *keymap_load_startup(struct xkb_context *ctx, uint64_t *hash) {
+    // Keyed by the names in effect now, so a changed XKB_DEFAULT_LAYOUT etc.
+    // never brings back the previous layout
+    *hash = names_hash();
+    gchar *dir = cache_dir();
+    struct xkb_keymap *keymap = dir ? cache_load(ctx, dir, *hash) : NULL;
+    if (!keymap) {
+        keymap = xkb_keymap_new_from_names(ctx, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        if (keymap && dir) cache_store(keymap, dir, *hash);
+    }
+    g_free(dir);
+    return keymap;
+}
+
+static void keymap_install(struct client_state *state, struct xkb_keymap *keymap, uint64_t hash) {
+    struct xkb_state *xkb_state = xkb_state_new(keymap);
+    if (!xkb_state) {
+        xkb_keymap_unref(keymap);
+        return;
+    }
+    xkb_state_unref(state->xkb_state);
+    xkb_keymap_unref(state->xkb_map);
+    state->xkb_map = keymap;
+    state->xkb_state = xkb_state;
+    state->keymap_hash = hash;
+    
+    // The new state starts with nothing held
+    state->ctrl_pressed = 0;
+    state->alt_pressed = 0;
+    state->shift_pressed = 0;
+    state->super_pressed = 0;
+    keys_invalidate_cache(state);
+}
+
+void keymap_from_fd(struct client_state *state, uint32_t format, int fd, uint32_t size) {
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 || size == 0) {
+        close(fd);
+        return;
+    }
+    
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+    
+    size_t len = strnlen(map, size);
+    uint64_t hash = hash_text(map, len);
+    if (hash != state->keymap_hash || !state->xkb_map) {
+        struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(state->xkb_ctx, map, len,
+                                                               XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        if (keymap) {
+            keymap_install(state, keymap, hash);
+        } else {
+            fprintf(stderr, "Warning: failed to compile the compositor keymap\n");
+        }
+    }
+    munmap(map, size);
+}
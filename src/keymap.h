@@ -0,0 +1,18 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "state.h"
+
+// The startup keymap is cached serialized under $XDG_CACHE_HOME/keypop, keyed
+// by a hash of its RMLVO names, so later starts parse one self-contained
+// string instead of resolving the names against the whole XKB database.
+
+// Keymap for startup: the default from RMLVO names (and XKB_DEFAULT_*
+// variables), loaded from the cache or compiled and then cached. Sets *hash
+// to identify it.
+struct xkb_keymap *keymap_load_startup(struct xkb_context *ctx, uint64_t *hash);
+// Handle wl_keyboard.keymap: switch to the compositor's keymap unless it's
+// the one already in use. Takes ownership of fd.
+void keymap_from_fd(struct client_state *state, uint32_t format, int fd, uint32_t size);
+
+#endif
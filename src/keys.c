@@ -1,10 +1,16 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include <libinput.h>
 #include "keys.h"
 #include "buffer.h"
+#include "window.h"
+#include "draw.h"
+#include "latency.h"
 
 static const char* get_key_symbol(xkb_keysym_t keysym) {
     switch (keysym) {
@@ -46,33 +52,141 @@ static const char* get_key_symbol(xkb_keysym_t keysym) {
     }
 }
 
-static inline void show_window(struct client_state *state) {
-    state->window_visible = 1;
-}
+// Which modifier a key is, as a mask of enum seg_mod plus KEY_MOD_SHIFT
+#define KEY_MOD_SHIFT (1 << 3)
 
-static int is_modifier(xkb_keysym_t key) {
-    return (key == XKB_KEY_Control_L || key == XKB_KEY_Control_R ||
-            key == XKB_KEY_Alt_L || key == XKB_KEY_Alt_R ||
-            key == XKB_KEY_Super_L || key == XKB_KEY_Super_R ||
-            key == XKB_KEY_Shift_L || key == XKB_KEY_Shift_R);
+static uint8_t modifier_mask(xkb_keysym_t key) {
+    switch (key) {
+        case XKB_KEY_Control_L: case XKB_KEY_Control_R: return SEG_MOD_CTRL;
+        case XKB_KEY_Alt_L: case XKB_KEY_Alt_R:         return SEG_MOD_ALT;
+        case XKB_KEY_Super_L: case XKB_KEY_Super_R:     return SEG_MOD_SUPER;
+        case XKB_KEY_Shift_L: case XKB_KEY_Shift_R:     return KEY_MOD_SHIFT;
+        default: return 0;
+    }
 }
 
+// Everything process_key_action() needs to know about a key at one shift level
+struct key_translation {
+    xkb_keysym_t keysym;
+    uint8_t modifier;          // Non-zero if the key itself is a modifier
+    uint8_t icon;              // enum key_icon
+    uint8_t valid;
+    char label[SEG_TEXT_MAX];  // Empty for keys that display nothing
+};
 
+// Translations for the current layout group and lock state, indexed by xkb
+// keycode and shift level. Keycodes or levels outside the table are translated
+// on every use.
+#define KEY_CACHE_CODES 256
+#define KEY_CACHE_LEVELS 4
 
-static void process_key_action(struct client_state *state, uint32_t key) {
-    uint32_t xkb_keycode = key + 8;
-    xkb_state_update_key(state->xkb_state, xkb_keycode, XKB_KEY_DOWN);
-    xkb_keysym_t keysym = xkb_state_key_get_one_sym(state->xkb_state, xkb_keycode);
+struct key_cache {
+    struct key_translation entries[KEY_CACHE_CODES][KEY_CACHE_LEVELS];
+};
+
+static void translate_key(struct xkb_state *xkb_state, uint32_t xkb_keycode, struct key_translation *t) {
+    xkb_keysym_t keysym = xkb_state_key_get_one_sym(xkb_state, xkb_keycode);
+    t->keysym = keysym;
+    t->modifier = modifier_mask(keysym);
+    t->icon = ICON_NONE;
+    t->label[0] = '\0';
+
+    const char *sym = get_key_symbol(keysym);
+    // First check if we have a named symbol
+    if (sym) {
+        snprintf(t->label, sizeof(t->label), "%s", sym);
+        t->icon = icon_for_keysym(keysym);
+    }
+    // Special case for space (render as space character)
+    else if (keysym == XKB_KEY_space) {
+        strcpy(t->label, " ");
+    }
+    // Try to get printable ASCII characters
+    else if (keysym >= 0x20 && keysym <= 0x7E) {
+        snprintf(t->label, sizeof(t->label), "%c", (char)keysym);
+    }
+    // For other keys, try UTF-8 conversion
+    else {
+        xkb_state_key_get_utf8(xkb_state, xkb_keycode, t->label, sizeof(t->label));
+        // If UTF-8 failed or returned control character, try keysym as char if in range
+        if (strlen(t->label) == 0 || (unsigned char)t->label[0] < 32) {
+            if (keysym < 256 && keysym >= 32) {
+                snprintf(t->label, sizeof(t->label), "%c", (char)keysym);
+            }
+            // Otherwise just ignore this key (don't display anything)
+            else {
+                t->label[0] = '\0';
+            }
+        }
+    }
+    t->valid = 1;
+}
+
+static const struct key_translation *lookup_key(struct client_state *state, uint32_t xkb_keycode) {
+    static struct key_translation uncached;
     
-    int is_mod = is_modifier(keysym);
-    if (keysym == XKB_KEY_Control_L || keysym == XKB_KEY_Control_R) state->ctrl_pressed = 1;
-    if (keysym == XKB_KEY_Alt_L || keysym == XKB_KEY_Alt_R) state->alt_pressed = 1;
-    if (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R) state->shift_pressed = 1;
-    if (keysym == XKB_KEY_Super_L || keysym == XKB_KEY_Super_R) state->super_pressed = 1;
+    xkb_layout_index_t layout = xkb_state_key_get_layout(state->xkb_state, xkb_keycode);
+    xkb_level_index_t level = xkb_state_key_get_level(state->xkb_state, xkb_keycode, layout);
+    if (xkb_keycode >= KEY_CACHE_CODES || level >= KEY_CACHE_LEVELS) {
+        translate_key(state->xkb_state, xkb_keycode, &uncached);
+        return &uncached;
+    }
+    
+    if (!state->key_cache) {
+        state->key_cache = calloc(1, sizeof(*state->key_cache));
+        if (!state->key_cache) {
+            translate_key(state->xkb_state, xkb_keycode, &uncached);
+            return &uncached;
+        }
+    }
+    struct key_translation *t = &state->key_cache->entries[xkb_keycode][level];
+    if (!t->valid) translate_key(state->xkb_state, xkb_keycode, t);
+    return t;
+}
+
+void keys_invalidate_cache(struct client_state *state) {
+    if (state->key_cache) memset(state->key_cache, 0, sizeof(*state->key_cache));
+}
+
+void keys_destroy(struct client_state *state) {
+    free(state->key_cache);
+    state->key_cache = NULL;
+    if (state->repeat_watch_id) loop_remove(state->loop, state->repeat_watch_id);
+    if (state->repeat_fd >= 0) close(state->repeat_fd);
+    state->repeat_watch_id = 0;
+    state->repeat_fd = -1;
+}
+
+// Feed a key transition to xkb. Cached translations depend on the layout group
+// and locked modifiers (Caps/Num Lock), not on held modifiers, which select a
+// level and are part of the cache index.
+static void update_key(struct client_state *state, uint32_t xkb_keycode, enum xkb_key_direction direction) {
+    enum xkb_state_component changed = xkb_state_update_key(state->xkb_state, xkb_keycode, direction);
+    if (changed & (XKB_STATE_LAYOUT_EFFECTIVE | XKB_STATE_MODS_LOCKED)) keys_invalidate_cache(state);
+}
+
+static void set_modifier(struct client_state *state, uint8_t modifier, int pressed) {
+    if (modifier & SEG_MOD_CTRL) state->ctrl_pressed = pressed;
+    if (modifier & SEG_MOD_ALT) state->alt_pressed = pressed;
+    if (modifier & KEY_MOD_SHIFT) state->shift_pressed = pressed;
+    if (modifier & SEG_MOD_SUPER) state->super_pressed = pressed;
+}
+
+// time_usec is when the key event happened: the libinput timestamp, or the
+// timer expiry for synthesized repeats
+static void process_key_action(struct client_state *state, const struct key_translation *t, uint64_t time_usec) {
+    xkb_keysym_t keysym = t->keysym;
+    set_modifier(state, t->modifier, 1);
 
     if (state->overlay_enabled) {
+        // Latency is measured for the oldest key not yet on screen
+        struct latency_mark *mark = &state->latency_pending;
+        if (!mark->input_usec) {
+            mark->input_usec = time_usec;
+            mark->handled_usec = latency_now_usec();
+            mark->first = !state->window_visible;
+        }
         show_window(state);
-        clock_gettime(CLOCK_MONOTONIC, &state->last_key_time);
 
         if (keysym == XKB_KEY_BackSpace) {
             if (state->ctrl_pressed) {
@@ -82,44 +196,13 @@ static void process_key_action(struct client_state *state, uint32_t key) {
             }
         } else if (state->ctrl_pressed && keysym == XKB_KEY_w) {
             buf_delete_word(state);
-        } else if (!is_mod) {
-            char combined_buf[64] = {0};
-            if (state->ctrl_pressed) strcat(combined_buf, "Ctrl+");
-            if (state->alt_pressed) strcat(combined_buf, "Alt+");
-            if (state->super_pressed) strcat(combined_buf, "Super+");
-            
-            const char *sym = get_key_symbol(keysym);
-            char key_str[32] = {0};
+        } else if (!t->modifier) {
+            uint8_t mods = 0;
+            if (state->ctrl_pressed) mods |= SEG_MOD_CTRL;
+            if (state->alt_pressed) mods |= SEG_MOD_ALT;
+            if (state->super_pressed) mods |= SEG_MOD_SUPER;
             
-            // First check if we have a named symbol
-            if (sym) {
-                strcpy(key_str, sym);
-            } 
-            // Special case for space (render as space character)
-            else if (keysym == XKB_KEY_space) {
-                strcpy(key_str, " ");
-            }
-            // Try to get printable ASCII characters
-            else if (keysym >= 0x20 && keysym <= 0x7E) {
-                snprintf(key_str, sizeof(key_str), "%c", (char)keysym);
-            }
-            // For other keys, try UTF-8 conversion
-            else {
-                xkb_state_key_get_utf8(state->xkb_state, xkb_keycode, key_str, sizeof(key_str));
-                // If UTF-8 failed or returned control character, try keysym as char if in range
-                if (strlen(key_str) == 0 || (unsigned char)key_str[0] < 32) {
-                    if (keysym < 256 && keysym >= 32) {
-                        snprintf(key_str, sizeof(key_str), "%c", (char)keysym);
-                    }
-                    // Otherwise just ignore this key (don't display anything)
-                    else {
-                        key_str[0] = '\0';
-                    }
-                }
-            }
-            
-            strcat(combined_buf, key_str);
-            if (strlen(combined_buf) > 0) {
+            if (mods || t->label[0]) {
                 // Combo highlighting: Detect important shortcuts and set colors
                 state->use_combo_color = 0; // Reset
                 
@@ -156,94 +239,135 @@ static void process_key_action(struct client_state *state, uint32_t key) {
                     state->use_combo_color = 1;
                 }
                 
-                if (state->seg_count > 0) {
-                    int last_len = state->seg_lengths[state->seg_count - 1];
-                    int this_len = strlen(combined_buf);
-                    int prev_is_special = (last_len > 1 && state->display_buf[state->display_len - 1] != ' ');
-                    int this_is_special = (this_len > 1 && combined_buf[0] != ' ');
-                    if (prev_is_special || this_is_special) buf_append(state, " ");
+                // Same key again: count it instead of filling the buffer
+                if (!buf_repeat(state, mods, keysym, t->label)) {
+                    // Keep combos and named keys visually apart from their neighbours
+                    const struct segment *last = buf_last(state);
+                    if (last) {
+                        int prev_is_special = (last->mods || strlen(last->text) > 1);
+                        int this_is_special = (mods || strlen(t->label) > 1);
+                        if (prev_is_special || this_is_special) buf_append(state, 0, XKB_KEY_NoSymbol, ICON_NONE, " ");
+                    }
+                    buf_append(state, mods, keysym, t->icon, t->label);
                 }
-                buf_append(state, combined_buf);
             }
         }
+        if (!mark->appended_usec) mark->appended_usec = latency_now_usec();
         state->needs_redraw = 1;
     }
 }
 
-// Timer for subsequent repeats (rate)
-static gboolean repeat_rate_tick(gpointer data) {
-    struct client_state *state = data;
-    process_key_action(state, state->repeat_key);
-    return TRUE; // Continue repeating
+// Key repeat runs off one absolute-deadline timerfd. Repeat n of a press is due
+// at press + delay + n / rate, computed from n rather than accumulated, so it
+// never drifts or rounds to whole milliseconds. A late wakeup applies every
+// repeat that came due in one batch with a single redraw.
+#define REPEAT_MAX_BATCH_SEC 1 // Beyond this (e.g. after suspend) skip ahead instead
+
+static uint64_t monotonic_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t repeat_deadline(const struct client_state *state, uint64_t n) {
+    return state->repeat_start_nsec + n * 1000000000ULL / (uint64_t)state->repeat_rate;
+}
+
+static void repeat_arm(struct client_state *state, uint64_t deadline_nsec) {
+    struct itimerspec its = {
+        .it_value = { .tv_sec = deadline_nsec / 1000000000, .tv_nsec = deadline_nsec % 1000000000 },
+    };
+    timerfd_settime(state->repeat_fd, TFD_TIMER_ABSTIME, &its, NULL);
 }
 
-// Timer for initial delay
-static gboolean repeat_delay_done(gpointer data) {
+static void repeat_stop(struct client_state *state) {
+    struct itimerspec its = {0};
+    if (state->repeat_fd >= 0) timerfd_settime(state->repeat_fd, 0, &its, NULL);
+    state->repeat_key = 0;
+}
+
+static int on_repeat_timer(void *data, uint32_t events) {
+    (void)events;
     struct client_state *state = data;
-    // Execute once
-    process_key_action(state, state->repeat_key);
+    uint64_t expirations;
+    // EAGAIN: disarmed between the wakeup and now
+    if (read(state->repeat_fd, &expirations, sizeof(expirations)) < 0) return 1;
+    if (!state->repeat_key || state->repeat_rate <= 0) return 1;
+
+    const uint64_t now = monotonic_nsec();
+    const struct key_translation *t = lookup_key(state, state->repeat_key + 8);
+    uint64_t batch = 0;
+    uint64_t deadline;
+    while ((deadline = repeat_deadline(state, state->repeat_count)) <= now) {
+        if (batch == (uint64_t)state->repeat_rate * REPEAT_MAX_BATCH_SEC) {
+            state->repeat_count = (now - state->repeat_start_nsec) * state->repeat_rate / 1000000000ULL + 1;
+            break;
+        }
+        process_key_action(state, t, deadline / 1000);
+        state->repeat_count++;
+        batch++;
+    }
+    if (batch) schedule_frame(state);
+    repeat_arm(state, repeat_deadline(state, state->repeat_count));
+    return 1;
+}
+
+// press_usec is the press time of the key, so repeats line up with the
+// physical key rather than with when we got around to processing it
+static void repeat_start(struct client_state *state, uint32_t key, uint64_t press_usec) {
+    if (state->repeat_fd < 0) return;
+    uint64_t now = monotonic_nsec();
+    uint64_t press = press_usec * 1000;
+    if (!press || press > now) press = now;
     
-    // Switch to rate timer
-    if (state->repeat_rate > 0) {
-        state->repeat_timer_id = g_timeout_add(1000 / state->repeat_rate, repeat_rate_tick, state);
-    } else {
-        state->repeat_timer_id = 0;
+    state->repeat_key = key;
+    state->repeat_start_nsec = press + (uint64_t)state->repeat_delay * 1000000;
+    state->repeat_count = 0;
+    repeat_arm(state, state->repeat_start_nsec);
+}
+
+int keys_init(struct client_state *state) {
+    state->repeat_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (state->repeat_fd < 0) {
+        fprintf(stderr, "Failed to create key repeat timer\n");
+        return -1;
     }
-    return FALSE; // Stop the delay timer
+    state->repeat_watch_id = loop_add_fd(state->loop, state->repeat_fd, on_repeat_timer, state);
+    return 0;
 }
 
-void handle_key(void *data, uint32_t key, uint32_t state_val) {
+void handle_key(void *data, uint32_t key, uint32_t state_val, uint64_t time_usec) {
     struct client_state *state = data;
     uint32_t xkb_keycode = key + 8;
 
-    // Check if it's a modifier key
-    // We need to peek at the keysym before updating state in process_key_action
-    // Note: This relies on the current state mapping.
-    xkb_keysym_t raw_sym = xkb_state_key_get_one_sym(state->xkb_state, xkb_keycode);
-    int is_mod_key = is_modifier(raw_sym);
-
     if (state_val == LIBINPUT_KEY_STATE_PRESSED) {
         // Guard: If it's a modifier and we think it's already pressed, ignore this repeat.
         // This handles case where libinput sends repeats OR we messed up logic.
-        if (is_mod_key) {
-             if ((raw_sym == XKB_KEY_Shift_L || raw_sym == XKB_KEY_Shift_R) && state->shift_pressed) return;
-             if ((raw_sym == XKB_KEY_Control_L || raw_sym == XKB_KEY_Control_R) && state->ctrl_pressed) return;
-             if ((raw_sym == XKB_KEY_Alt_L || raw_sym == XKB_KEY_Alt_R) && state->alt_pressed) return;
-             if ((raw_sym == XKB_KEY_Super_L || raw_sym == XKB_KEY_Super_R) && state->super_pressed) return;
-        }
+        // Note: This relies on the mapping before the press is applied.
+        uint8_t modifier = lookup_key(state, xkb_keycode)->modifier;
+        if ((modifier & KEY_MOD_SHIFT) && state->shift_pressed) return;
+        if ((modifier & SEG_MOD_CTRL) && state->ctrl_pressed) return;
+        if ((modifier & SEG_MOD_ALT) && state->alt_pressed) return;
+        if ((modifier & SEG_MOD_SUPER) && state->super_pressed) return;
 
-        // Cancel existing timer if any
-        if (state->repeat_timer_id) {
-            g_source_remove(state->repeat_timer_id);
-            state->repeat_timer_id = 0;
-        }
+        // A new press ends the previous key's repeat
+        repeat_stop(state);
 
-        // Process the key immediately
-        process_key_action(state, key);
+        // Process the key immediately, translated at the level after the press
+        update_key(state, xkb_keycode, XKB_KEY_DOWN);
+        const struct key_translation *t = lookup_key(state, xkb_keycode);
+        process_key_action(state, t, time_usec);
         
         // Setup repeat if enabled (but NOT for modifiers)
-        // process_key_action already updated xkb_state, so we can just query the keysym
-        xkb_keysym_t keysym = xkb_state_key_get_one_sym(state->xkb_state, xkb_keycode);
-        if (!is_modifier(keysym) && state->repeat_rate > 0 && state->repeat_delay > 0) {
-            state->repeat_key = key;
-            state->repeat_timer_id = g_timeout_add(state->repeat_delay, repeat_delay_done, state);
+        if (!t->modifier && state->repeat_rate > 0 && state->repeat_delay > 0) {
+            repeat_start(state, key, time_usec);
         }
         
     } else {
         // Key Release
-        if (state->repeat_key == key) {
-            if (state->repeat_timer_id) {
-                g_source_remove(state->repeat_timer_id);
-                state->repeat_timer_id = 0;
-            }
-            state->repeat_key = 0;
-        }
+        if (state->repeat_key == key) repeat_stop(state);
 
-        xkb_state_update_key(state->xkb_state, xkb_keycode, XKB_KEY_UP);
-        xkb_keysym_t keysym = xkb_state_key_get_one_sym(state->xkb_state, xkb_keycode);
-        if (keysym == XKB_KEY_Control_L || keysym == XKB_KEY_Control_R) state->ctrl_pressed = 0;
-        if (keysym == XKB_KEY_Alt_L || keysym == XKB_KEY_Alt_R) state->alt_pressed = 0;
-        if (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R) state->shift_pressed = 0;
-        if (keysym == XKB_KEY_Super_L || keysym == XKB_KEY_Super_R) state->super_pressed = 0;
+        update_key(state, xkb_keycode, XKB_KEY_UP);
+        set_modifier(state, lookup_key(state, xkb_keycode)->modifier, 0);
     }
 }
@@ -3,6 +3,11 @@
 
 #include "state.h"
 
-void handle_key(void *data, uint32_t key, uint32_t state_val);
+// Set up the key repeat timer on the main loop
+int keys_init(struct client_state *state);
+void handle_key(void *data, uint32_t key, uint32_t state_val, uint64_t time_usec);
+// Drop cached key translations; call whenever the keymap or layout group changes
+void keys_invalidate_cache(struct client_state *state);
+void keys_destroy(struct client_state *state);
 
 #endif
@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "latency.h"
+
+static const char *stage_names[LAT_STAGE_COUNT] = {
+    [LAT_INPUT_TO_HANDLE]   = "input->handle",
+    [LAT_HANDLE_TO_APPEND]  = "handle->append",
+    [LAT_APPEND_TO_RENDER]  = "append->render",
+    [LAT_RENDER]            = "render",
+    [LAT_COMMIT_TO_PRESENT] = "commit->present",
+    [LAT_INPUT_TO_COMMIT]   = "input->commit",
+    [LAT_INPUT_TO_PRESENT]  = "input->present",
+    [LAT_FIRST_TO_COMMIT]   = "first->commit",
+    [LAT_FIRST_TO_PRESENT]  = "first->present",
+};
+
+uint64_t latency_now_usec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Values below LATENCY_SUB_BUCKETS get a bucket each; above that each power of
+// two is split into LATENCY_SUB_BUCKETS linear steps (<= 12.5% error)
+static int bucket_index(uint64_t usec) {
+    if (usec < LATENCY_SUB_BUCKETS) return (int)usec;
+    int exp = 63 - __builtin_clzll(usec); // >= 3
+    int sub = (int)((usec >> (exp - 3)) & (LATENCY_SUB_BUCKETS - 1));
+    int idx = (exp - 2) * LATENCY_SUB_BUCKETS + sub;
+    return idx < LATENCY_BUCKETS ? idx : LATENCY_BUCKETS - 1;
+}
+
+// Upper bound of a bucket, the value reported for percentiles
+static uint64_t bucket_limit(int idx) {
+    if (idx < LATENCY_SUB_BUCKETS) return idx;
+    int exp = idx / LATENCY_SUB_BUCKETS + 2;
+    int sub = idx % LATENCY_SUB_BUCKETS;
+    return ((uint64_t)(LATENCY_SUB_BUCKETS + sub + 1) << (exp - 3)) - 1;
+}
+
+static uint64_t percentile(const struct latency_histogram *h, double p) {
+    uint64_t target = (uint64_t)(h->count * p + 0.5);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            uint64_t limit = bucket_limit(i);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+void latency_record(struct latency_stats *stats, enum latency_stage stage, uint64_t start_usec, uint64_t end_usec) {
+    if (!start_usec || end_usec < start_usec) return; // Missing or clock mismatch
+    uint64_t usec = end_usec - start_usec;
+
+    struct latency_histogram *h = &stats->stages[stage];
+    h->buckets[bucket_index(usec)]++;
+    h->count++;
+    if (usec > h->max) h->max = usec;
+
+    if (stats->trace) {
+        fprintf(stats->trace,
+                "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%d},\n",
+                stage_names[stage], (unsigned long long)start_usec, (unsigned long long)usec, (int)stage + 1);
+    }
+}
+
+void latency_dump(const struct latency_stats *stats, FILE *out) {
+    fprintf(out, "%-16s %8s %10s %10s %10s\n", "stage (us)", "count", "p50", "p99", "max");
+    for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+        const struct latency_histogram *h = &stats->stages[i];
+        if (!h->count) continue;
+        fprintf(out, "%-16s %8llu %10llu %10llu %10llu\n", stage_names[i],
+                (unsigned long long)h->count,
+                (unsigned long long)percentile(h, 0.50),
+                (unsigned long long)percentile(h, 0.99),
+                (unsigned long long)h->max);
+    }
+    fflush(out);
+}
+
+int latency_trace_open(struct latency_stats *stats, const char *path) {
+    stats->trace = fopen(path, "w");
+    if (!stats->trace) return -1;
+    fputs("[\n", stats->trace);
+    for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+        // Name one track per stage
+        fprintf(stats->trace,
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                i + 1, stage_names[i]);
+    }
+    return 0;
+}
+
+void latency_trace_close(struct latency_stats *stats) {
+    if (!stats->trace) return;
+    fputs("{}]\n", stats->trace);
+    fclose(stats->trace);
+    stats->trace = NULL;
+}
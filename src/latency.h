@@ -0,0 +1,53 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Log-linear buckets: 8 per power of two of microseconds, up to ~2^29 us (9 min)
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS (27 * LATENCY_SUB_BUCKETS)
+
+enum latency_stage {
+    LAT_INPUT_TO_HANDLE,   // libinput timestamp -> handle_key()
+    LAT_HANDLE_TO_APPEND,  // handle_key() -> buf_append()
+    LAT_APPEND_TO_RENDER,  // buf_append() -> redraw() start (frame throttling)
+    LAT_RENDER,            // redraw() start -> wl_surface_commit()
+    LAT_COMMIT_TO_PRESENT, // wl_surface_commit() -> wp_presentation presented
+    LAT_INPUT_TO_COMMIT,
+    LAT_INPUT_TO_PRESENT,
+    LAT_FIRST_TO_COMMIT,   // Same as the two above, only for the key that
+    LAT_FIRST_TO_PRESENT,  // brought the overlay back after it was hidden
+    LAT_STAGE_COUNT
+};
+
+struct latency_histogram {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+struct latency_stats {
+    struct latency_histogram stages[LAT_STAGE_COUNT];
+    FILE *trace; // Chrome/Perfetto trace-event JSON, NULL when disabled
+};
+
+// Timestamps of the oldest key not yet on screen, 0 when nothing is pending
+struct latency_mark {
+    uint64_t input_usec;
+    uint64_t handled_usec;
+    uint64_t appended_usec;
+    unsigned int first : 1; // The key that shows the hidden overlay
+};
+
+// CLOCK_MONOTONIC in microseconds, the same clock libinput stamps events with
+uint64_t latency_now_usec(void);
+
+void latency_record(struct latency_stats *stats, enum latency_stage stage, uint64_t start_usec, uint64_t end_usec);
+// Print p50/p99/max for every stage that has samples
+void latency_dump(const struct latency_stats *stats, FILE *out);
+
+int latency_trace_open(struct latency_stats *stats, const char *path);
+void latency_trace_close(struct latency_stats *stats);
+
+#endif
@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include "loop.h"
+
+#define LOOP_MAX_SOURCES 32
+#define LOOP_TAG_TIMER  0          // epoll tags; fd sources are tagged with their id
+#define LOOP_TAG_SIGNAL UINT32_MAX
+
+enum source_type {
+    SOURCE_NONE,
+    SOURCE_FD,
+    SOURCE_TIMEOUT,
+    SOURCE_SIGNAL,
+};
+
+struct loop_source {
+    unsigned int id;        // 0 when the slot is free
+    enum source_type type;
+    int fd;                 // SOURCE_FD
+    int signo;              // SOURCE_SIGNAL
+    uint64_t deadline_nsec; // SOURCE_TIMEOUT, CLOCK_MONOTONIC
+    unsigned int interval_ms;
+    loop_fd_cb fd_cb;
+    loop_cb cb;
+    void *data;
+};
+
+struct loop {
+    enum loop_backend backend;
+    GMainLoop *glib;
+
+    // Epoll backend
+    int epoll_fd;
+    int timer_fd;
+    int signal_fd;
+    sigset_t signals;
+    unsigned int next_id;
+    unsigned int quit : 1;
+    struct loop_source sources[LOOP_MAX_SOURCES];
+};
+
+// GLib backend: thin adapters so callers see the same callback types
+
+struct glib_closure {
+    loop_fd_cb fd_cb;
+    loop_cb cb;
+    void *data;
+};
+
+static gboolean glib_fd_dispatch(gint fd, GIOCondition condition, gpointer data) {
+    (void)fd;
+    struct glib_closure *closure = data;
+    uint32_t events = 0;
+    if (condition & G_IO_IN) events |= LOOP_READABLE;
+    if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) events |= LOOP_HANGUP;
+    return closure->fd_cb(closure->data, events) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gboolean glib_dispatch(gpointer data) {
+    struct glib_closure *closure = data;
+    return closure->cb(closure->data) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static struct glib_closure *glib_closure_new(loop_fd_cb fd_cb, loop_cb cb, void *data) {
+    struct glib_closure *closure = g_new0(struct glib_closure, 1);
+    closure->fd_cb = fd_cb;
+    closure->cb = cb;
+    closure->data = data;
+    return closure;
+}
+
+// Epoll backend
+
+static uint64_t monotonic_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct loop_source *source_alloc(struct loop *loop, enum source_type type) {
+    for (int i = 0; i < LOOP_MAX_SOURCES; i++) {
+        struct loop_source *source = &loop->sources[i];
+        if (source->id) continue;
+        memset(source, 0, sizeof(*source));
+        if (++loop->next_id == LOOP_TAG_SIGNAL) loop->next_id = 1;
+        source->id = loop->next_id;
+        source->type = type;
+        return source;
+    }
+    fprintf(stderr, "Main loop: too many sources\n");
+    return NULL;
+}
+
+static struct loop_source *source_find(struct loop *loop, unsigned int id) {
+    for (int i = 0; i < LOOP_MAX_SOURCES; i++) {
+        if (loop->sources[i].id == id) return &loop->sources[i];
+    }
+    return NULL;
+}
+
+// Point the timerfd at the earliest timeout, or disarm it
+static void timers_arm(struct loop *loop) {
+    uint64_t next = 0;
+    for (int i = 0; i < LOOP_MAX_SOURCES; i++) {
+        const struct loop_source *source = &loop->sources[i];
+        if (source->id && source->type == SOURCE_TIMEOUT && (!next || source->deadline_nsec < next)) {
+            next = source->deadline_nsec;
+        }
+    }
+    struct itimerspec its = {
+        .it_value = { .tv_sec = next / 1000000000ULL, .tv_nsec = next % 1000000000ULL },
+    };
+    timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void timers_dispatch(struct loop *loop) {
+    uint64_t expirations;
+    if (read(loop->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) return;
+
+    uint64_t now = monotonic_nsec();
+    for (int i = 0; i < LOOP_MAX_SOURCES; i++) {
+        struct loop_source *source = &loop->sources[i];
+        if (!source->id || source->type != SOURCE_TIMEOUT || source->deadline_nsec > now) continue;
+        unsigned int id = source->id;
+        int keep = source->cb(source->data);
+        // The callback may have removed this source, or removed it and reused the slot
+        if (source->id != id) continue;
+        if (keep) source->deadline_nsec = now + (uint64_t)source->interval_ms * 1000000ULL;
+        else source->id = 0;
+    }
+    timers_arm(loop);
+}
+
+static void signals_dispatch(struct loop *loop) {
+    struct signalfd_siginfo info;
+    while (read(loop->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        for (int i = 0; i < LOOP_MAX_SOURCES; i++) {
+            struct loop_source *source = &loop->sources[i];
+            if (!source->id || source->type != SOURCE_SIGNAL || source->signo != (int)info.ssi_signo) continue;
+            if (!source->cb(source->data) && source->id) loop_remove(loop, source->id);
+        }
+    }
+}
+
+static void fd_dispatch(struct loop *loop, const struct epoll_event *ev) {
+    struct loop_source *source = source_find(loop, ev->data.u32);
+    if (!source) return; // Removed earlier in this batch
+    uint32_t events = 0;
+    if (ev->events & EPOLLIN) events |= LOOP_READABLE;
+    if (ev->events & (EPOLLERR | EPOLLHUP)) events |= LOOP_HANGUP;
+    unsigned int id = source->id;
+    if (!source->fd_cb(source->data, events) && source->id == id) loop_remove(loop, id);
+}
+
+struct loop *loop_new(enum loop_backend backend) {
+    struct loop *loop = calloc(1, sizeof(*loop));
+    loop->backend = backend;
+    loop->epoll_fd = loop->timer_fd = loop->signal_fd = -1;
+    if (backend == LOOP_BACKEND_GLIB) {
+        loop->glib = g_main_loop_new(NULL, FALSE);
+        return loop;
+    }
+
+    sigemptyset(&loop->signals);
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = LOOP_TAG_TIMER };
+    if (loop->epoll_fd < 0 || loop->timer_fd < 0 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->timer_fd, &ev) < 0) {
+        fprintf(stderr, "Failed to create main loop: %s\n", strerror(errno));
+        loop_free(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+unsigned int loop_add_fd(struct loop *loop, int fd, loop_fd_cb cb, void *data) {
+    if (loop->glib) {
+        return g_unix_fd_add_full(G_PRIORITY_DEFAULT, fd, G_IO_IN | G_IO_ERR | G_IO_HUP, glib_fd_dispatch,
+                                  glib_closure_new(cb, NULL, data), g_free);
+    }
+    struct loop_source *source = source_alloc(loop, SOURCE_FD);
+    if (!source) return 0;
+    source->fd = fd;
+    source->fd_cb = cb;
+    source->data = data;
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = source->id };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        source->id = 0;
+        return 0;
+    }
+    return source->id;
+}
+
+unsigned int loop_add_timeout(struct loop *loop, unsigned int ms, loop_cb cb, void *data) {
+    if (loop->glib) {
+        return g_timeout_add_full(G_PRIORITY_DEFAULT, ms, glib_dispatch, glib_closure_new(NULL, cb, data), g_free);
+    }
+    struct loop_source *source = source_alloc(loop, SOURCE_TIMEOUT);
+    if (!source) return 0;
+    source->interval_ms = ms;
+    source->deadline_nsec = monotonic_nsec() + (uint64_t)ms * 1000000ULL;
+    source->cb = cb;
+    source->data = data;
+    timers_arm(loop);
+    return source->id;
+}
+
+unsigned int loop_add_signal(struct loop *loop, int signo, loop_cb cb, void *data) {
+    if (loop->glib) {
+        return g_unix_signal_add_full(G_PRIORITY_DEFAULT, signo, glib_dispatch, glib_closure_new(NULL, cb, data), g_free);
+    }
+    struct loop_source *source = source_alloc(loop, SOURCE_SIGNAL);
+    if (!source) return 0;
+    source->signo = signo;
+    source->cb = cb;
+    source->data = data;
+
+    // Blocked, the signal stays queued for the signalfd instead of its default action
+    sigaddset(&loop->signals, signo);
+    sigprocmask(SIG_BLOCK, &loop->signals, NULL);
+    int first = loop->signal_fd < 0;
+    loop->signal_fd = signalfd(loop->signal_fd, &loop->signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = LOOP_TAG_SIGNAL };
+    if (loop->signal_fd < 0 || (first && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->signal_fd, &ev) < 0)) {
+        fprintf(stderr, "Failed to watch signal %d: %s\n", signo, strerror(errno));
+        source->id = 0;
+        return 0;
+    }
+    return source->id;
+}
+
+void loop_remove(struct loop *loop, unsigned int id) {
+    if (loop->glib) {
+        g_source_remove(id);
+        return;
+    }
+    struct loop_source *source = source_find(loop, id);
+    if (!source) return;
+    source->id = 0;
+    if (source->type == SOURCE_FD) epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    else if (source->type == SOURCE_TIMEOUT) timers_arm(loop);
+}
+
+void loop_run(struct loop *loop) {
+    if (loop->glib) {
+        g_main_loop_run(loop->glib);
+        return;
+    }
+    loop->quit = 0;
+    while (!loop->quit) {
+        struct epoll_event ready[LOOP_MAX_SOURCES];
+        int count = epoll_wait(loop->epoll_fd, ready, LOOP_MAX_SOURCES, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Main loop: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < count && !loop->quit; i++) {
+            if (ready[i].data.u32 == LOOP_TAG_TIMER) timers_dispatch(loop);
+            else if (ready[i].data.u32 == LOOP_TAG_SIGNAL) signals_dispatch(loop);
+            else fd_dispatch(loop, &ready[i]);
+        }
+    }
+}
+
+void loop_quit(struct loop *loop) {
+    if (loop->glib) g_main_loop_quit(loop->glib);
+    else loop->quit = 1;
+}
+
+void loop_free(struct loop *loop) {
+    if (!loop) return;
+    if (loop->glib) g_main_loop_unref(loop->glib);
+    if (loop->signal_fd >= 0) {
+        close(loop->signal_fd);
+        sigprocmask(SIG_UNBLOCK, &loop->signals, NULL);
+    }
+    if (loop->timer_fd >= 0) close(loop->timer_fd);
+    if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+    free(loop);
+}
@@ -0,0 +1,37 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+
+// Main loop with two backends. The tray talks GDBus and needs a GLib main
+// context; without it everything runs on epoll, with all timeouts sharing
+// one timerfd and signals arriving through a signalfd.
+struct loop;
+
+enum loop_backend {
+    LOOP_BACKEND_GLIB,
+    LOOP_BACKEND_EPOLL,
+};
+
+// Events passed to fd callbacks
+#define LOOP_READABLE 1
+#define LOOP_HANGUP   2 // Error or hangup
+
+// Callbacks return nonzero to keep the source, 0 to remove it. A kept
+// timeout fires again after the same interval.
+typedef int (*loop_fd_cb)(void *data, uint32_t events);
+typedef int (*loop_cb)(void *data);
+
+struct loop *loop_new(enum loop_backend backend);
+// Source ids are never 0
+unsigned int loop_add_fd(struct loop *loop, int fd, loop_fd_cb cb, void *data);
+unsigned int loop_add_timeout(struct loop *loop, unsigned int ms, loop_cb cb, void *data);
+// With the epoll backend the signal is blocked for the whole process, so add
+// signals before starting any threads
+unsigned int loop_add_signal(struct loop *loop, int signo, loop_cb cb, void *data);
+void loop_remove(struct loop *loop, unsigned int id);
+void loop_run(struct loop *loop);
+void loop_quit(struct loop *loop);
+void loop_free(struct loop *loop);
+
+#endif
@@ -1,70 +1,65 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
-#include <glib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
 #include <wayland-client.h>
 #include "state.h"
 #include "wl_setup.h"
 #include "window.h"
 #include "keys.h"
+#include "keymap.h"
+#include "devfilter.h"
 #include "draw.h"
 #include "tray.h"
+#include "loop.h"
 
-// Helper for time
-static inline long time_diff_ms(const struct timespec *start, const struct timespec *end) {
-    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+// Main loop callbacks
+static int on_terminate(void *data) {
+    struct client_state *state = data;
+    state->running = 0;
+    loop_quit(state->loop);
+    return 1;
+}
+
+// Nothing left to draw on without the compositor
+static int on_display_lost(struct client_state *state) {
+    fprintf(stderr, "Lost the Wayland connection\n");
+    on_terminate(state);
+    return 0;
 }
 
-// GLib callbacks
-static gboolean on_wayland_event(GIOChannel *source, GIOCondition condition, gpointer data) {
-    (void)source;
+static int on_wayland_event(void *data, uint32_t events) {
     struct client_state *state = data;
-    if (condition & G_IO_IN) {
-        if (wl_display_dispatch(state->display) == -1) return FALSE;
+    if (events & LOOP_READABLE) {
+        if (wl_display_dispatch(state->display) == -1) return on_display_lost(state);
     }
-    if (condition & (G_IO_ERR | G_IO_HUP)) return FALSE;
-    return TRUE;
+    if (events & LOOP_HANGUP) return on_display_lost(state);
+    // Frame callbacks and buffer releases may have committed a new frame
+    if (wl_display_flush(state->display) < 0 && errno != EAGAIN) return on_display_lost(state);
+    return 1;
 }
 
-static gboolean on_input_event(GIOChannel *source, GIOCondition condition, gpointer data) {
-    (void)source;
+static int on_input_event(void *data, uint32_t events) {
     struct client_state *state = data;
-    if (condition & G_IO_IN) {
+    if (events & LOOP_READABLE) {
         input_dispatch(state->input);
+        // Render the whole batch at once rather than per event
+        schedule_frame(state);
     }
-    return TRUE;
+    return 1;
 }
 
-static gboolean on_timer_tick(gpointer data) {
+static int on_dump_latency(void *data) {
     struct client_state *state = data;
-    
-    // Auto-hide logic
-    if (state->window_visible) {
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        if (time_diff_ms(&state->last_key_time, &now) > HIDE_TIMEOUT_MS) {
-            hide_window(state);
-            state->needs_redraw = 0; // hide_window commits, so no redraw needed
-        }
-    }
-
-    // Redraw logic
-    if (state->needs_redraw && state->window_visible) {
-        redraw(state);
-        state->needs_redraw = 0;
-    }
-    
-    // Flush wayland
-    if (wl_display_flush(state->display) < 0 && errno != EAGAIN) {
-        return FALSE; // Error
-    }
-
-    return TRUE; // Continue calling
+    latency_dump(&state->latency, stderr);
+    return 1;
 }
 
-// Helper to parse hex color
 // Helper to parse hex color
 static void parse_color(const char *hex, double *rgba) {
     if (!hex) return;
@@ -85,14 +80,52 @@ static void parse_color(const char *hex, double *rgba) {
     rgba[3] = a / 255.0;
 }
 
+// "bottom-right", "top", "center", ... as layer surface anchor edges
+static int parse_anchor(const char *spec, uint32_t *anchor) {
+    static const struct { const char *name; uint32_t edge; } edges[] = {
+        { "top", ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP },
+        { "bottom", ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM },
+        { "left", ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT },
+        { "right", ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT },
+        { "center", 0 },
+    };
+    *anchor = 0;
+    while (*spec) {
+        size_t len = strcspn(spec, "-");
+        size_t i;
+        for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+            if (strlen(edges[i].name) == len && strncmp(spec, edges[i].name, len) == 0) break;
+        }
+        if (i == sizeof(edges) / sizeof(edges[0])) return -1;
+        *anchor |= edges[i].edge;
+        spec += len;
+        if (*spec == '-') spec++;
+    }
+    return 0;
+}
+
 static void print_usage(const char *prog) {
     printf("Usage: %s [options]\n", prog);
     printf("Options:\n");
     printf("  -b <color>   Set background color (e.g. #000000 or 000000)\n");
     printf("  -c <color>   Set text color (e.g. #FFFFFF or FFFFFF)\n");
     printf("  -s <size>    Set font size (default: 65)\n");
+    printf("  -f <font>    Font family and style, e.g. 'JetBrains Mono Bold' (default: %s)\n", FONT_DEFAULT);
     printf("  -g <WxH>     Set window size (default: 840x130)\n");
     printf("  -o <opacity> Set background opacity (0.0 - 1.0)\n");
+    printf("  -p <pos>     Screen position with layer-shell, e.g. top-left, bottom (default: bottom-right)\n");
+    printf("  -m <px>      Distance from the screen edges with layer-shell (default: 20)\n");
+    printf("  -T           Read input on a dedicated thread\n");
+    printf("  -E           Read /dev/input event nodes directly instead of via libinput\n");
+    printf("  -D <rules>   Input devices to open, e.g. 'keyboard,!name=*YubiKey*'\n");
+    printf("               (default: keyboard, plus pointer unless --no-mouse)\n");
+    printf("  -L <file>    Write a keystroke latency trace (Chrome trace-event JSON)\n");
+    printf("  -r <file>    Record input events to file\n");
+    printf("  -R <file>    Replay input events from file instead of reading devices\n");
+    printf("  -F           Replay as fast as possible instead of with original timing\n");
+    printf("  --no-tray    Don't create a tray icon\n");
+    printf("  --unmap      Unmap the overlay when idle instead of keeping it mapped and transparent\n");
+    printf("  --no-mouse   Don't show mouse buttons (pointer events are ignored)\n");
     printf("  -h           Show this help\n");
 }
 
@@ -100,11 +133,14 @@ int main(int argc, char *argv[]) {
     struct client_state state = {0};
     state.running = 1;
     state.overlay_enabled = 1; // Default to shown
-    clock_gettime(CLOCK_MONOTONIC, &state.last_key_time);
+    state.show_mouse = 1;
+    state.warm_hide = 1;
     
     // Default config
     state.width = DEFAULT_WIDTH;
     state.height = DEFAULT_HEIGHT;
+    state.anchor = ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM | ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT;
+    state.margin = 20;
 
     state.bg_color[0] = 0.0;
     state.bg_color[1] = 0.0;
@@ -121,9 +157,29 @@ int main(int argc, char *argv[]) {
     // Default repeat settings (will be updated by Wayland)
     state.repeat_rate = 25;
     state.repeat_delay = 600;
+    state.repeat_fd = -1;
+
+    int threaded_input = 0;
+    enum input_backend backend = INPUT_BACKEND_LIBINPUT;
+    const char *font_spec = NULL;
+    const char *trace_path = NULL;
+    const char *record_path = NULL;
+    const char *device_spec = NULL;
+    const char *replay_path = NULL;
+    int replay_fast = 0;
+    int use_tray = 1;
+
+    enum { OPT_NO_TRAY = 256, OPT_NO_MOUSE, OPT_UNMAP };
+    static const struct option long_options[] = {
+        { "no-tray", no_argument, NULL, OPT_NO_TRAY },
+        { "no-mouse", no_argument, NULL, OPT_NO_MOUSE },
+        { "unmap",   no_argument, NULL, OPT_UNMAP },
+        { "help",    no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "b:c:s:g:o:h")) != -1) {
+    while ((opt = getopt_long(argc, argv, "b:c:s:f:g:o:p:m:TED:L:r:R:Fh", long_options, NULL)) != -1) {
         switch (opt) {
             case 'b':
                 parse_color(optarg, state.bg_color);
@@ -135,6 +191,9 @@ int main(int argc, char *argv[]) {
                 state.font_size = atoi(optarg);
                 if (state.font_size < 10) state.font_size = 10;
                 break;
+            case 'f':
+                font_spec = optarg;
+                break;
             case 'g':
                 sscanf(optarg, "%dx%d", &state.width, &state.height);
                 if (state.width < 100) state.width = 100;
@@ -147,6 +206,46 @@ int main(int argc, char *argv[]) {
                 state.bg_color[3] = opacity;
                 break;
             }
+            case 'p':
+                if (parse_anchor(optarg, &state.anchor) != 0) {
+                    fprintf(stderr, "Unknown position '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                state.margin = atoi(optarg);
+                if (state.margin < 0) state.margin = 0;
+                break;
+            case 'T':
+                threaded_input = 1;
+                break;
+            case 'E':
+                backend = INPUT_BACKEND_EVDEV;
+                break;
+            case 'D':
+                device_spec = optarg;
+                break;
+            case 'L':
+                trace_path = optarg;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'R':
+                replay_path = optarg;
+                break;
+            case 'F':
+                replay_fast = 1;
+                break;
+            case OPT_NO_TRAY:
+                use_tray = 0;
+                break;
+            case OPT_NO_MOUSE:
+                state.show_mouse = 0;
+                break;
+            case OPT_UNMAP:
+                state.warm_hide = 0;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -156,59 +255,84 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Initialize subsystems
-    if (wl_setup_connect(&state) != 0) {
-        fprintf(stderr, "Failed to connect to Wayland\n");
+    // Resolve fonts up front so the first key doesn't pay for fontconfig
+    if (font_init(&state.font, font_spec, NULL) != 0) return 1;
+    if (font_init(&state.mouse_font, font_spec, &state.font) != 0) return 1;
+    font_set_weight(&state.mouse_font, PANGO_WEIGHT_NORMAL);
+
+    // Only the tray needs GLib's main loop
+    state.loop = loop_new(use_tray ? LOOP_BACKEND_GLIB : LOOP_BACKEND_EPOLL);
+    if (!state.loop) return 1;
+    // SIGUSR1 prints latency percentiles; quit cleanly so the trace is complete.
+    // Before any thread exists, so the epoll backend's blocked signals apply to all.
+    loop_add_signal(state.loop, SIGUSR1, on_dump_latency, &state);
+    loop_add_signal(state.loop, SIGINT, on_terminate, &state);
+    loop_add_signal(state.loop, SIGTERM, on_terminate, &state);
+
+    if (trace_path && latency_trace_open(&state.latency, trace_path) != 0) {
+        fprintf(stderr, "Failed to open trace file %s\n", trace_path);
         return 1;
     }
 
+    // Initialize subsystems. The keymap comes first: the compositor may send
+    // its own as soon as the seat is bound.
     state.xkb_ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    state.xkb_map = xkb_keymap_new_from_names(state.xkb_ctx, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!state.xkb_ctx) return 1;
+    state.xkb_map = keymap_load_startup(state.xkb_ctx, &state.keymap_hash);
+    if (!state.xkb_map) return 1;
     state.xkb_state = xkb_state_new(state.xkb_map);
-    if (!state.xkb_ctx || !state.xkb_map || !state.xkb_state) return 1;
+    if (!state.xkb_state) return 1;
+    keys_init(&state); // Without it keys just don't repeat
 
-    state.input = input_init(handle_key, &state);
-    if (!state.input) fprintf(stderr, "Warning: Failed to init input\n");
+    if (wl_setup_connect(&state) != 0) {
+        fprintf(stderr, "Failed to connect to Wayland\n");
+        return 1;
+    }
+
+    if (replay_path) {
+        state.input = input_init_replay(handle_key, &state, replay_path, !replay_fast);
+        if (!state.input) return 1;
+    } else {
+        struct device_filter *filter = device_filter_new(device_spec, state.show_mouse);
+        if (!filter) return 1;
+        state.input = input_init(handle_key, &state, filter, backend);
+        if (!state.input) fprintf(stderr, "Warning: Failed to init input\n");
+        else if (threaded_input) input_start_thread(state.input);
+    }
+    if (state.input) input_set_pointer(state.input, state.show_mouse);
+    if (state.input && record_path && input_record_to(state.input, record_path) != 0) {
+        fprintf(stderr, "Failed to create input recording %s\n", record_path);
+        return 1;
+    }
 
     window_create(&state);
     
-    // Setup Tray
-    tray_init(&state);
-
-    // Setup GMainLoop
-    state.loop = g_main_loop_new(NULL, FALSE);
-
-    // Add Wayland fd
-    GIOChannel *wl_chan = g_io_channel_unix_new(wl_display_get_fd(state.display));
-    g_io_add_watch(wl_chan, G_IO_IN | G_IO_ERR | G_IO_HUP, on_wayland_event, &state);
-    g_io_channel_unref(wl_chan);
-
-    // Add Input fd
-    if (state.input) {
-        GIOChannel *in_chan = g_io_channel_unix_new(input_get_fd(state.input));
-        g_io_add_watch(in_chan, G_IO_IN, on_input_event, &state);
-        g_io_channel_unref(in_chan);
-    }
+    // Setup Tray once the main loop runs, after input and the surface are live
+    if (use_tray) tray_init(&state);
 
-    // Add Timer (approx 60fps or less, just for auto-hide checks and flush)
-    // 16ms = ~60fps
-    g_timeout_add(16, on_timer_tick, &state);
+    loop_add_fd(state.loop, wl_display_get_fd(state.display), on_wayland_event, &state);
+    if (state.input) loop_add_fd(state.loop, input_get_fd(state.input), on_input_event, &state);
 
     // Initial Flush
     wl_display_roundtrip(state.display);
 
-    // Run Loop
-    g_main_loop_run(state.loop);
+    loop_run(state.loop);
 
     // Cleanup
-    if (state.buffer) wl_buffer_destroy(state.buffer);
+    shm_pool_destroy(&state.pool);
+    seg_cache_clear(&state.seg_cache);
+    icon_atlas_destroy(&state.icon_atlas);
+    font_destroy(&state.font);
+    font_destroy(&state.mouse_font);
     if (state.input) input_destroy(state.input);
-    // tray_destroy(&state); // Not strictly needed on exit
+    latency_trace_close(&state.latency);
+    if (use_tray) tray_destroy(&state);
+    keys_destroy(&state);
     xkb_state_unref(state.xkb_state);
     xkb_keymap_unref(state.xkb_map);
     xkb_context_unref(state.xkb_ctx);
     wl_setup_disconnect(&state);
-    g_main_loop_unref(state.loop);
+    loop_free(state.loop);
     
     return 0;
 }
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "recording.h"
+
+static const char magic[8] = { 'K', 'P', 'R', 'E', 'C', 0, 0, 1 };
+
+#define FLAG_TYPE_MASK  0x03
+#define FLAG_PRESSED    0x04
+#define FLAG_DEVICE     0x08
+#define MOTION_SCALE    256.0f
+
+struct recording {
+    FILE *file;
+    uint64_t last_time;
+    uint16_t last_device;
+};
+
+static void put_varint(FILE *f, uint64_t v) {
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, f);
+        v >>= 7;
+    }
+    putc((int)v, f);
+}
+
+static int get_varint(FILE *f, uint64_t *out) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return -1;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+struct recording *recording_create(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return NULL;
+    struct recording *rec = calloc(1, sizeof(*rec));
+    if (!rec) {
+        fclose(file);
+        return NULL;
+    }
+    rec->file = file;
+    fwrite(magic, 1, sizeof(magic), file);
+    return rec;
+}
+
+struct recording *recording_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    char header[sizeof(magic)];
+    struct recording *rec = NULL;
+    if (fread(header, 1, sizeof(header), file) == sizeof(header) &&
+        memcmp(header, magic, sizeof(magic)) == 0) {
+        rec = calloc(1, sizeof(*rec));
+    }
+    if (!rec) {
+        fclose(file);
+        return NULL;
+    }
+    rec->file = file;
+    return rec;
+}
+
+int recording_write(struct recording *rec, const struct input_record *ev) {
+    int flags = ev->type & FLAG_TYPE_MASK;
+    if (ev->pressed) flags |= FLAG_PRESSED;
+    if (ev->device != rec->last_device) flags |= FLAG_DEVICE;
+    putc(flags, rec->file);
+    if (flags & FLAG_DEVICE) put_varint(rec->file, ev->device);
+    // Timestamps only go backwards across devices in theory; clamp rather than wrap
+    put_varint(rec->file, ev->time_usec > rec->last_time ? ev->time_usec - rec->last_time : 0);
+
+    if (ev->type == INPUT_RECORD_MOTION) {
+        put_varint(rec->file, zigzag(lrintf(ev->dx * MOTION_SCALE)));
+        put_varint(rec->file, zigzag(lrintf(ev->dy * MOTION_SCALE)));
+    } else {
+        put_varint(rec->file, ev->code);
+    }
+
+    if (ev->time_usec > rec->last_time) rec->last_time = ev->time_usec;
+    rec->last_device = ev->device;
+    return ferror(rec->file) ? -1 : 0;
+}
+
+int recording_read(struct recording *rec, struct input_record *ev) {
+    int flags = getc(rec->file);
+    if (flags == EOF) return 0;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->type = flags & FLAG_TYPE_MASK;
+    ev->pressed = (flags & FLAG_PRESSED) != 0;
+    if (ev->type > INPUT_RECORD_MOTION) return -1;
+
+    uint64_t v;
+    if (flags & FLAG_DEVICE) {
+        if (get_varint(rec->file, &v) < 0) return -1;
+        rec->last_device = (uint16_t)v;
+    }
+    ev->device = rec->last_device;
+    if (get_varint(rec->file, &v) < 0) return -1;
+    rec->last_time += v;
+    ev->time_usec = rec->last_time;
+
+    if (ev->type == INPUT_RECORD_MOTION) {
+        uint64_t dx, dy;
+        if (get_varint(rec->file, &dx) < 0 || get_varint(rec->file, &dy) < 0) return -1;
+        ev->dx = unzigzag(dx) / MOTION_SCALE;
+        ev->dy = unzigzag(dy) / MOTION_SCALE;
+    } else {
+        if (get_varint(rec->file, &v) < 0) return -1;
+        ev->code = (uint32_t)v;
+    }
+    return 1;
+}
+
+void recording_close(struct recording *rec) {
+    if (!rec) return;
+    fclose(rec->file);
+    free(rec);
+}
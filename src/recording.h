@@ -0,0 +1,21 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include "input.h"
+
+// Compact on-disk stream of input_records. After an 8 byte header each record
+// is a flags byte (type, pressed, device changed), LEB128 varints for the
+// device (only when it changed) and the time since the previous record, then
+// the key/button code or the motion deltas as zigzag varints in 1/256 px.
+// A typical key event takes 4-5 bytes instead of sizeof(struct input_record).
+
+struct recording;
+
+struct recording *recording_create(const char *path);
+struct recording *recording_open(const char *path);
+int recording_write(struct recording *rec, const struct input_record *ev);
+// Returns 1 when ev was filled, 0 at end of file, -1 on a malformed file
+int recording_read(struct recording *rec, struct input_record *ev);
+void recording_close(struct recording *rec);
+
+#endif
@@ -0,0 +1,58 @@
+#include <string.h>
+#include "segcache.h"
+
+// FNV-1a over the text, mixed with the font size. Colour is compared exactly.
+static uint32_t seg_hash(const char *text, int font_size) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    h ^= (uint32_t)font_size;
+    h *= 16777619u;
+    return h;
+}
+
+static int seg_matches(const struct seg_cache_entry *e, uint32_t hash, const char *text, const double *color, int font_size) {
+    return e->last_used && e->hash == hash && e->font_size == font_size &&
+           memcmp(e->color, color, sizeof(e->color)) == 0 &&
+           strcmp(e->text, text) == 0;
+}
+
+struct seg_cache_entry *seg_cache_lookup(struct seg_cache *cache, const char *text, const double *color, int font_size) {
+    uint32_t hash = seg_hash(text, font_size);
+    for (int i = 0; i < SEG_CACHE_SIZE; i++) {
+        struct seg_cache_entry *e = &cache->entries[i];
+        if (seg_matches(e, hash, text, color, font_size)) {
+            e->last_used = ++cache->tick;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+struct seg_cache_entry *seg_cache_insert(struct seg_cache *cache, const char *text, const double *color, int font_size) {
+    struct seg_cache_entry *victim = &cache->entries[0];
+    for (int i = 0; i < SEG_CACHE_SIZE; i++) {
+        struct seg_cache_entry *e = &cache->entries[i];
+        if (e->last_used < victim->last_used) victim = e;
+        if (!e->last_used) break; // Empty slot, can't do better
+    }
+
+    if (victim->surface) cairo_surface_destroy(victim->surface);
+    memset(victim, 0, sizeof(*victim));
+
+    victim->hash = seg_hash(text, font_size);
+    strncpy(victim->text, text, SEG_CACHE_TEXT - 1);
+    memcpy(victim->color, color, sizeof(victim->color));
+    victim->font_size = font_size;
+    victim->last_used = ++cache->tick;
+    return victim;
+}
+
+void seg_cache_clear(struct seg_cache *cache) {
+    for (int i = 0; i < SEG_CACHE_SIZE; i++) {
+        if (cache->entries[i].surface) cairo_surface_destroy(cache->entries[i].surface);
+    }
+    memset(cache, 0, sizeof(*cache));
+}
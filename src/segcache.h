@@ -0,0 +1,37 @@
+#ifndef SEGCACHE_H
+#define SEGCACHE_H
+
+#include <stdint.h>
+#include <cairo.h>
+
+#define SEG_CACHE_SIZE 64
+#define SEG_CACHE_TEXT 128
+
+// A segment rasterized once onto a transparent surface. The pen origin
+// (start of the baseline) sits at (origin_x, origin_y) inside the surface.
+struct seg_cache_entry {
+    uint32_t hash;
+    char text[SEG_CACHE_TEXT];
+    double color[4];
+    int font_size;
+
+    cairo_surface_t *surface;
+    double origin_x;
+    double origin_y;
+    double width; // Advance, used for layout
+
+    uint64_t last_used; // 0 = empty slot
+};
+
+struct seg_cache {
+    struct seg_cache_entry entries[SEG_CACHE_SIZE];
+    uint64_t tick;
+};
+
+// Returns the matching entry (marking it most recently used) or NULL
+struct seg_cache_entry *seg_cache_lookup(struct seg_cache *cache, const char *text, const double *color, int font_size);
+// Claims the least recently used slot for the key; the caller fills surface/origin/width
+struct seg_cache_entry *seg_cache_insert(struct seg_cache *cache, const char *text, const double *color, int font_size);
+void seg_cache_clear(struct seg_cache *cache);
+
+#endif
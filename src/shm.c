@@ -24,3 +24,80 @@ int allocate_shm_file(size_t size) {
     }
     return fd;
 }
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    struct shm_pool *pool = data;
+    for (int i = 0; i < SHM_POOL_BUFFERS; i++) {
+        if (pool->buffers[i].wl_buffer == wl_buffer) pool->buffers[i].busy = 0;
+    }
+    if (pool->on_release) pool->on_release(pool->release_data);
+}
+static const struct wl_buffer_listener buffer_listener = { .release = buffer_release };
+
+void shm_pool_destroy(struct shm_pool *pool) {
+    if (pool->clear.wl_buffer) wl_buffer_destroy(pool->clear.wl_buffer);
+    pool->clear = (struct shm_buffer){0};
+    for (int i = 0; i < SHM_POOL_BUFFERS; i++) {
+        struct shm_buffer *buf = &pool->buffers[i];
+        if (buf->surface) cairo_surface_destroy(buf->surface);
+        if (buf->wl_buffer) wl_buffer_destroy(buf->wl_buffer);
+        buf->surface = NULL;
+        buf->wl_buffer = NULL;
+        buf->data = NULL;
+        buf->busy = 0;
+    }
+    if (pool->wl_pool) wl_shm_pool_destroy(pool->wl_pool);
+    if (pool->data) munmap(pool->data, pool->size);
+    pool->wl_pool = NULL;
+    pool->data = NULL;
+    pool->size = 0;
+    pool->width = pool->height = pool->stride = 0;
+    pool->format = 0;
+}
+
+int shm_pool_resize(struct shm_pool *pool, struct wl_shm *shm, int width, int height, uint32_t format) {
+    if (pool->data && pool->width == width && pool->height == height && pool->format == format) return 0;
+    // From here on every buffer is new and zeroed, whatever it held before
+    shm_pool_destroy(pool);
+    const cairo_format_t cairo_format = format == WL_SHM_FORMAT_XRGB8888 ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
+
+    const int stride = width * 4;
+    const size_t buf_size = (size_t)stride * height;
+    const size_t size = buf_size * (SHM_POOL_BUFFERS + 1); // ftruncate zero-fills the clear buffer
+
+    int fd = allocate_shm_file(size);
+    if (fd == -1) return -1;
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) { close(fd); return -1; }
+
+    pool->data = data;
+    pool->size = size;
+    pool->width = width;
+    pool->height = height;
+    pool->stride = stride;
+    pool->format = format;
+    pool->wl_pool = wl_shm_create_pool(shm, fd, size);
+    close(fd);
+
+    for (int i = 0; i < SHM_POOL_BUFFERS; i++) {
+        struct shm_buffer *buf = &pool->buffers[i];
+        buf->data = (char *)data + buf_size * i;
+        buf->wl_buffer = wl_shm_pool_create_buffer(pool->wl_pool, buf_size * i,
+            width, height, stride, format);
+        wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, pool);
+        buf->surface = cairo_image_surface_create_for_data(buf->data, cairo_format, width, height, stride);
+        buf->busy = 0;
+    }
+    pool->clear.data = (char *)data + buf_size * SHM_POOL_BUFFERS;
+    pool->clear.wl_buffer = wl_shm_pool_create_buffer(pool->wl_pool, buf_size * SHM_POOL_BUFFERS,
+        width, height, stride, WL_SHM_FORMAT_ARGB8888);
+    return 1;
+}
+
+struct shm_buffer *shm_pool_acquire(struct shm_pool *pool) {
+    for (int i = 0; i < SHM_POOL_BUFFERS; i++) {
+        if (pool->buffers[i].wl_buffer && !pool->buffers[i].busy) return &pool->buffers[i];
+    }
+    return NULL; // All buffers held by the compositor, caller should defer the frame
+}
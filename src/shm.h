@@ -2,7 +2,43 @@
 #define SHM_H
 
 #include <stddef.h>
+#include <wayland-client.h>
+#include <cairo.h>
+
+#define SHM_POOL_BUFFERS 3
+
+struct shm_buffer {
+    struct wl_buffer *wl_buffer;
+    cairo_surface_t *surface;
+    void *data;
+    unsigned int busy : 1; // Attached and not yet released by the compositor
+};
+
+// One shm file carved into SHM_POOL_BUFFERS equally sized buffers, plus a
+// fully transparent one. Recreated only when the requested geometry or
+// format changes.
+struct shm_pool {
+    struct wl_shm_pool *wl_pool;
+    void *data;
+    size_t size;
+    int width;
+    int height;
+    int stride;
+    uint32_t format; // WL_SHM_FORMAT_ARGB8888 or XRGB8888; the clear buffer is always ARGB
+    struct shm_buffer buffers[SHM_POOL_BUFFERS];
+    struct shm_buffer clear; // All zero and never drawn into, so it may stay attached anywhere
+
+    // Invoked when the compositor hands a buffer back, so deferred frames can be retried
+    void (*on_release)(void *data);
+    void *release_data;
+};
 
 int allocate_shm_file(size_t size);
 
+// Returns 0 if the pool already matched, 1 if it was (re)created, in which
+// case no buffer holds a previous frame any more, and -1 on failure
+int shm_pool_resize(struct shm_pool *pool, struct wl_shm *shm, int width, int height, uint32_t format);
+struct shm_buffer *shm_pool_acquire(struct shm_pool *pool);
+void shm_pool_destroy(struct shm_pool *pool);
+
 #endif
@@ -2,25 +2,80 @@
 #define STATE_H
 
 #include <time.h>
-#include <glib.h>
 #include <wayland-client.h>
 #include <xkbcommon/xkbcommon.h>
 #include "xdg-shell-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "wlr-layer-shell-unstable-v1-client-protocol.h"
 #include "input.h"
+#include "shm.h"
+#include "segcache.h"
+#include "icons.h"
+#include "latency.h"
+#include "loop.h"
+#include "font.h"
 
 #define DEFAULT_WIDTH 840
 #define DEFAULT_HEIGHT 130
 #define PADDING 10
 #define TOP_BOTTOM_PADDING 5
 #define RIGHT_PADDING 60
-#define MAX_DISPLAY_LEN 256
-#define MAX_SEGMENTS 128
+#define MAX_SEGMENTS 128 // Power of two, the segment ring index is masked
+#define SEG_TEXT_MAX 32
 #define HIDE_TIMEOUT_MS 2000
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+enum seg_mod {
+    SEG_MOD_CTRL  = 1 << 0,
+    SEG_MOD_ALT   = 1 << 1,
+    SEG_MOD_SUPER = 1 << 2,
+};
+
+// One displayed key (or separator). Drawn as the modifier prefix ("Ctrl+Alt+")
+// followed by the icon if there is one, otherwise by the text label, and then
+// the repeat count ("×23") if the key was pressed more than once in a row.
+struct segment {
+    uint32_t id;             // Unique per appended segment
+    uint8_t mods;            // enum seg_mod mask
+    uint8_t icon;            // enum key_icon
+    xkb_keysym_t keysym;     // XKB_KEY_NoSymbol for separators
+    uint16_t count;          // Consecutive presses collapsed into this segment
+    char text[SEG_TEXT_MAX]; // UTF-8 key label
+    // Layout, measured once on append: pixel-snapped advance and the running
+    // total through this segment. Totals only ever grow from an arbitrary base,
+    // so evicting the oldest segment leaves the remaining ones valid.
+    double width;
+    double end;
+    uint64_t time_usec;      // CLOCK_MONOTONIC when appended
+};
+
+// What was drawn where in the last committed frame, used to scroll pixels
+// instead of repainting them. Items are ordered newest (rightmost) first.
+struct frame_item {
+    uint32_t id;       // Segment id, stable while the segment stays in the buffer
+    int x;             // Pen position in buffer pixels
+    double width;
+    int seg;           // Logical segment index for this frame only
+    unsigned int combo : 1;
+};
+
+struct frame_layout {
+    struct shm_buffer *buffer; // Buffer holding these pixels
+    int width;
+    int height;
+    uint32_t format;           // Pool format the pixels were drawn in
+    int font_size;
+    int pad;                   // Margin around each segment bitmap
+    int band_y0, band_y1;      // Rows covered by segment bitmaps
+    int count;
+    struct frame_item items[MAX_SEGMENTS];
+    unsigned int mouse : 1;    // Mouse line was drawn
+    unsigned int valid : 1;
+};
+
 struct client_state {
     // Wayland objects
     struct wl_display *display;
@@ -33,35 +88,59 @@ struct client_state {
     struct wl_surface *surface;
     struct xdg_surface *xdg_surface;
     struct xdg_toplevel *xdg_toplevel;
-    struct wl_buffer *buffer;
+    struct zwlr_layer_shell_v1 *layer_shell;     // Preferred over xdg-shell when offered
+    struct zwlr_layer_surface_v1 *layer_surface;
+    struct wp_presentation *presentation; // Optional, for latency tracing
+    clockid_t presentation_clock;
+    struct shm_pool pool;
+    struct wl_callback *frame_cb; // Pending wl_surface.frame, NULL when idle
     
     // Input
     struct input_state *input;
     struct xkb_context *xkb_ctx;
     struct xkb_keymap *xkb_map;
     struct xkb_state *xkb_state;
+    struct key_cache *key_cache; // Per-keycode translations, see keys.c
+    uint64_t keymap_hash;        // Source text hash of the installed keymap
     
     // Key Repeat State
     int32_t repeat_rate;   // chars per second
     int32_t repeat_delay;  // ms
-    uint32_t repeat_key;   // currently holding key (raw code)
-    guint repeat_timer_id; // GLib timer source ID
+    uint32_t repeat_key;   // currently holding key (raw code), 0 when not repeating
+    int repeat_fd;         // timerfd armed for the next repeat deadline
+    unsigned int repeat_watch_id; // Main loop watch on repeat_fd
+    uint64_t repeat_start_nsec; // CLOCK_MONOTONIC of the first repeat
+    uint64_t repeat_count;      // Repeats applied since the press
 
-    // Display state
-    char display_buf[MAX_DISPLAY_LEN];
-    size_t display_len;
-    
-    // Segment tracking for atomic backspace
-    int seg_lengths[MAX_SEGMENTS];
+    // Display state: ring of the most recent segments, oldest at seg_head
+    struct segment segments[MAX_SEGMENTS];
+    int seg_head;
     int seg_count;
+    uint32_t next_seg_id;
+    
+    // Rasterized segments, reused across frames
+    struct seg_cache seg_cache;
+    struct icon_atlas icon_atlas;
+    struct frame_layout last_frame;
+    struct font font;        // Segment text, resolved once at startup
+    struct font mouse_font;  // Regular weight, for the click display
     
     struct timespec last_key_time;
+    unsigned int hide_timer_id; // One-shot auto-hide deadline, 0 when disarmed
+    
+    // Keystroke-to-photon latency
+    struct latency_stats latency;
+    struct latency_mark latency_pending;
     
     // Flags
     unsigned int running : 1;
     unsigned int window_visible : 1;
+    unsigned int configured : 1;       // Surface has acked a configure and may take a buffer
+    unsigned int warm_hide : 1;        // Hide by going transparent instead of unmapping
+    unsigned int opaque : 1;           // Opaque region currently covers the surface
     unsigned int needs_redraw : 1;
     unsigned int overlay_enabled : 1;  // Controls whether app shows when typing
+    unsigned int show_mouse : 1;       // Show mouse buttons and position
     
     // Modifiers state
     unsigned int ctrl_pressed : 1;
@@ -75,6 +154,8 @@ struct client_state {
     int font_size;
     int width;
     int height;
+    uint32_t anchor;     // Layer surface edges (ZWLR_LAYER_SURFACE_V1_ANCHOR_*), 0 centres
+    int margin;          // Distance from the anchored edges
 
     // Combo highlighting
     double current_combo_color[4]; // Color for current combo (if special)
@@ -87,11 +168,13 @@ struct client_state {
         unsigned int mmb : 1;
         int x;
         int y;
+        float pending_dx; // Sub-pixel motion not yet applied to x/y
+        float pending_dy;
         struct timespec last_click_time;
     } mouse;
 
-    // GLib Main Loop
-    GMainLoop *loop;
+    // Main loop, GLib-backed only when the tray needs it
+    struct loop *loop;
 };
 
 #endif
@@ -1,90 +1,351 @@
-#include <libappindicator/app-indicator.h>
-#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <gio/gio.h>
 #include "tray.h"
 #include "window.h"
 
-// Forward declaration
-static void on_exit_activate(GtkMenuItem *item, void *data);
-static void on_toggle_activate(GtkMenuItem *item, void *data);
+// StatusNotifierItem with a com.canonical.dbusmenu menu, spoken directly over
+// GDBus so the tray costs no toolkit
+
+#define ITEM_PATH "/StatusNotifierItem"
+#define MENU_PATH "/MenuBar"
+
+enum menu_id {
+    MENU_ROOT,
+    MENU_TOGGLE,
+    MENU_EXIT,
+};
+
+static const char introspection_xml[] =
+    "<node>"
+    "  <interface name='org.kde.StatusNotifierItem'>"
+    "    <property name='Category' type='s' access='read'/>"
+    "    <property name='Id' type='s' access='read'/>"
+    "    <property name='Title' type='s' access='read'/>"
+    "    <property name='Status' type='s' access='read'/>"
+    "    <property name='WindowId' type='i' access='read'/>"
+    "    <property name='IconName' type='s' access='read'/>"
+    "    <property name='IconThemePath' type='s' access='read'/>"
+    "    <property name='ItemIsMenu' type='b' access='read'/>"
+    "    <property name='Menu' type='o' access='read'/>"
+    "    <method name='ContextMenu'><arg name='x' type='i' direction='in'/><arg name='y' type='i' direction='in'/></method>"
+    "    <method name='Activate'><arg name='x' type='i' direction='in'/><arg name='y' type='i' direction='in'/></method>"
+    "    <method name='SecondaryActivate'><arg name='x' type='i' direction='in'/><arg name='y' type='i' direction='in'/></method>"
+    "    <method name='Scroll'><arg name='delta' type='i' direction='in'/><arg name='orientation' type='s' direction='in'/></method>"
+    "  </interface>"
+    "  <interface name='com.canonical.dbusmenu'>"
+    "    <property name='Version' type='u' access='read'/>"
+    "    <property name='TextDirection' type='s' access='read'/>"
+    "    <property name='Status' type='s' access='read'/>"
+    "    <property name='IconThemePath' type='as' access='read'/>"
+    "    <method name='GetLayout'>"
+    "      <arg name='parentId' type='i' direction='in'/>"
+    "      <arg name='recursionDepth' type='i' direction='in'/>"
+    "      <arg name='propertyNames' type='as' direction='in'/>"
+    "      <arg name='revision' type='u' direction='out'/>"
+    "      <arg name='layout' type='(ia{sv}av)' direction='out'/>"
+    "    </method>"
+    "    <method name='GetGroupProperties'>"
+    "      <arg name='ids' type='ai' direction='in'/>"
+    "      <arg name='propertyNames' type='as' direction='in'/>"
+    "      <arg name='properties' type='a(ia{sv})' direction='out'/>"
+    "    </method>"
+    "    <method name='GetProperty'>"
+    "      <arg name='id' type='i' direction='in'/>"
+    "      <arg name='name' type='s' direction='in'/>"
+    "      <arg name='value' type='v' direction='out'/>"
+    "    </method>"
+    "    <method name='Event'>"
+    "      <arg name='id' type='i' direction='in'/>"
+    "      <arg name='eventId' type='s' direction='in'/>"
+    "      <arg name='data' type='v' direction='in'/>"
+    "      <arg name='timestamp' type='u' direction='in'/>"
+    "    </method>"
+    "    <method name='EventGroup'>"
+    "      <arg name='events' type='a(isvu)' direction='in'/>"
+    "      <arg name='idErrors' type='ai' direction='out'/>"
+    "    </method>"
+    "    <method name='AboutToShow'>"
+    "      <arg name='id' type='i' direction='in'/>"
+    "      <arg name='needUpdate' type='b' direction='out'/>"
+    "    </method>"
+    "    <method name='AboutToShowGroup'>"
+    "      <arg name='ids' type='ai' direction='in'/>"
+    "      <arg name='updatesNeeded' type='ai' direction='out'/>"
+    "      <arg name='idErrors' type='ai' direction='out'/>"
+    "    </method>"
+    "    <signal name='ItemsPropertiesUpdated'>"
+    "      <arg name='updatedProps' type='a(ia{sv})'/>"
+    "      <arg name='removedProps' type='a(ias)'/>"
+    "    </signal>"
+    "    <signal name='LayoutUpdated'>"
+    "      <arg name='revision' type='u'/>"
+    "      <arg name='parent' type='i'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
 
 struct tray_ctx {
-    AppIndicator *indicator;
-    GtkWidget *menu;
-    GtkWidget *toggle_item;
     struct client_state *state;
+    GDBusConnection *connection;
+    GDBusNodeInfo *introspection;
+    guint watch_id;     // Bus name watch for the StatusNotifier host
+    guint item_id;      // Registered StatusNotifierItem object
+    guint menu_id;      // Registered dbusmenu object
+    guint own_id;       // Our org.kde.StatusNotifierItem-* name
+    char bus_name[64];
+    char icon_theme_path[1024];
+    guint32 revision;   // dbusmenu layout revision
+    unsigned int name_acquired : 1;
 };
 
 static struct tray_ctx ctx;
 
-static void update_toggle_label(void) {
-    // Checked = Shown, Unchecked = Hidden
-    const char *label = ctx.state->overlay_enabled ? "☑ Show && hide" : "☐ Show && hide";
-    gtk_menu_item_set_label(GTK_MENU_ITEM(ctx.toggle_item), label);
+// Properties of one menu item as a{sv}
+static GVariant *menu_item_properties(int id) {
+    GVariantBuilder props;
+    g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+    switch (id) {
+        case MENU_ROOT:
+            g_variant_builder_add(&props, "{sv}", "children-display", g_variant_new_string("submenu"));
+            break;
+        case MENU_TOGGLE:
+            // Checked = Shown, Unchecked = Hidden
+            g_variant_builder_add(&props, "{sv}", "label", g_variant_new_string("Show & hide"));
+            g_variant_builder_add(&props, "{sv}", "toggle-type", g_variant_new_string("checkmark"));
+            g_variant_builder_add(&props, "{sv}", "toggle-state", g_variant_new_int32(ctx.state->overlay_enabled));
+            break;
+        case MENU_EXIT:
+            g_variant_builder_add(&props, "{sv}", "label", g_variant_new_string("Exit"));
+            break;
+    }
+    return g_variant_builder_end(&props);
 }
 
-static void on_toggle_activate(GtkMenuItem *item, void *data) {
-    (void)item;
-    struct client_state *state = data;
+// (ia{sv}av) for id and, depth permitting, its children
+static GVariant *menu_layout(int id, int depth) {
+    GVariantBuilder children;
+    g_variant_builder_init(&children, G_VARIANT_TYPE("av"));
+    if (id == MENU_ROOT && depth != 0) {
+        g_variant_builder_add(&children, "v", menu_layout(MENU_TOGGLE, depth - 1));
+        g_variant_builder_add(&children, "v", menu_layout(MENU_EXIT, depth - 1));
+    }
+    return g_variant_new("(i@a{sv}@av)", id, menu_item_properties(id), g_variant_builder_end(&children));
+}
+
+static void toggle_overlay(struct client_state *state) {
     // Toggle the ENABLED state
     state->overlay_enabled = !state->overlay_enabled;
-    
+
     // Update checkbox immediately
-    update_toggle_label();
-    
+    GVariantBuilder updated;
+    g_variant_builder_init(&updated, G_VARIANT_TYPE("a(ia{sv})"));
+    g_variant_builder_add(&updated, "(i@a{sv})", MENU_TOGGLE, menu_item_properties(MENU_TOGGLE));
+    g_dbus_connection_emit_signal(ctx.connection, NULL, MENU_PATH, "com.canonical.dbusmenu",
+                                  "ItemsPropertiesUpdated",
+                                  g_variant_new("(@a(ia{sv})@a(ias))", g_variant_builder_end(&updated),
+                                                g_variant_new_array(G_VARIANT_TYPE("(ias)"), NULL, 0)),
+                                  NULL);
+
     if (!state->overlay_enabled) {
         hide_window(state);
     }
 }
 
-static void on_exit_activate(GtkMenuItem *item, void *data) {
-    (void)item;
-    struct client_state *state = data;
+static void exit_app(struct client_state *state) {
     state->running = 0;
-    if (state->loop) g_main_loop_quit(state->loop);
+    if (state->loop) loop_quit(state->loop);
 }
 
-int tray_init(struct client_state *state) {
-    ctx.state = state;
+static void menu_event(int id, const char *event_id) {
+    if (strcmp(event_id, "clicked") != 0) return;
+    if (id == MENU_TOGGLE) toggle_overlay(ctx.state);
+    else if (id == MENU_EXIT) exit_app(ctx.state);
+}
+
+static void menu_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                             const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+                             GDBusMethodInvocation *invocation, gpointer data) {
+    (void)connection; (void)sender; (void)object_path; (void)interface_name; (void)data;
+
+    if (strcmp(method_name, "GetLayout") == 0) {
+        gint32 parent, depth;
+        g_variant_get(parameters, "(ii@as)", &parent, &depth, NULL);
+        if (parent < MENU_ROOT || parent > MENU_EXIT) parent = MENU_ROOT;
+        g_dbus_method_invocation_return_value(invocation,
+            g_variant_new("(u@(ia{sv}av))", ctx.revision, menu_layout(parent, depth)));
+    } else if (strcmp(method_name, "GetGroupProperties") == 0) {
+        GVariantIter *ids;
+        g_variant_get(parameters, "(ai@as)", &ids, NULL);
+        GVariantBuilder props;
+        g_variant_builder_init(&props, G_VARIANT_TYPE("a(ia{sv})"));
+        gint32 id;
+        while (g_variant_iter_next(ids, "i", &id)) {
+            if (id < MENU_ROOT || id > MENU_EXIT) continue;
+            g_variant_builder_add(&props, "(i@a{sv})", id, menu_item_properties(id));
+        }
+        g_variant_iter_free(ids);
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a(ia{sv}))", g_variant_builder_end(&props)));
+    } else if (strcmp(method_name, "GetProperty") == 0) {
+        gint32 id;
+        const gchar *name;
+        g_variant_get(parameters, "(i&s)", &id, &name);
+        GVariant *props = menu_item_properties(id);
+        GVariant *value = g_variant_lookup_value(props, name, NULL);
+        g_variant_unref(g_variant_ref_sink(props));
+        if (!value) {
+            g_dbus_method_invocation_return_dbus_error(invocation, "com.canonical.dbusmenu.Error", "Unknown property");
+            return;
+        }
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(v)", value));
+        g_variant_unref(value);
+    } else if (strcmp(method_name, "Event") == 0) {
+        gint32 id;
+        const gchar *event_id;
+        g_variant_get(parameters, "(i&svu)", &id, &event_id, NULL, NULL);
+        menu_event(id, event_id);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (strcmp(method_name, "EventGroup") == 0) {
+        GVariantIter *events;
+        g_variant_get(parameters, "(a(isvu))", &events);
+        gint32 id;
+        const gchar *event_id;
+        while (g_variant_iter_next(events, "(i&svu)", &id, &event_id, NULL, NULL)) {
+            menu_event(id, event_id);
+        }
+        g_variant_iter_free(events);
+        g_dbus_method_invocation_return_value(invocation,
+            g_variant_new("(@ai)", g_variant_new_array(G_VARIANT_TYPE_INT32, NULL, 0)));
+    } else if (strcmp(method_name, "AboutToShow") == 0) {
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(b)", FALSE));
+    } else if (strcmp(method_name, "AboutToShowGroup") == 0) {
+        g_dbus_method_invocation_return_value(invocation,
+            g_variant_new("(@ai@ai)", g_variant_new_array(G_VARIANT_TYPE_INT32, NULL, 0),
+                          g_variant_new_array(G_VARIANT_TYPE_INT32, NULL, 0)));
+    } else {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.freedesktop.DBus.Error.UnknownMethod", method_name);
+    }
+}
+
+static GVariant *menu_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                   const gchar *interface_name, const gchar *property_name,
+                                   GError **error, gpointer data) {
+    (void)connection; (void)sender; (void)object_path; (void)interface_name; (void)error; (void)data;
+    if (strcmp(property_name, "Version") == 0) return g_variant_new_uint32(3);
+    if (strcmp(property_name, "TextDirection") == 0) return g_variant_new_string("ltr");
+    if (strcmp(property_name, "Status") == 0) return g_variant_new_string("normal");
+    if (strcmp(property_name, "IconThemePath") == 0) return g_variant_new_strv(NULL, 0);
+    return NULL;
+}
+
+static void item_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                             const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+                             GDBusMethodInvocation *invocation, gpointer data) {
+    (void)connection; (void)sender; (void)object_path; (void)interface_name; (void)method_name;
+    (void)parameters; (void)data;
+    // ItemIsMenu: hosts open the menu themselves, clicks need no action
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
 
-    int argc = 0;
-    char **argv = NULL;
-    if (!gtk_init_check(&argc, &argv)) {
-        fprintf(stderr, "Failed to init GTK for tray icon\n");
+static GVariant *item_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+                                   const gchar *interface_name, const gchar *property_name,
+                                   GError **error, gpointer data) {
+    (void)connection; (void)sender; (void)object_path; (void)interface_name; (void)error; (void)data;
+    if (strcmp(property_name, "Category") == 0) return g_variant_new_string("ApplicationStatus");
+    if (strcmp(property_name, "Id") == 0) return g_variant_new_string("keypop-tray");
+    if (strcmp(property_name, "Title") == 0) return g_variant_new_string("keypop");
+    if (strcmp(property_name, "Status") == 0) return g_variant_new_string("Active");
+    if (strcmp(property_name, "WindowId") == 0) return g_variant_new_int32(0);
+    if (strcmp(property_name, "IconName") == 0) {
+        return g_variant_new_string(ctx.icon_theme_path[0] ? "key_pop" : "input-keyboard");
+    }
+    if (strcmp(property_name, "IconThemePath") == 0) return g_variant_new_string(ctx.icon_theme_path);
+    if (strcmp(property_name, "ItemIsMenu") == 0) return g_variant_new_boolean(TRUE);
+    if (strcmp(property_name, "Menu") == 0) return g_variant_new_object_path(MENU_PATH);
+    return NULL;
+}
+
+static const GDBusInterfaceVTable item_vtable = {
+    .method_call = item_method_call,
+    .get_property = item_get_property,
+};
+
+static const GDBusInterfaceVTable menu_vtable = {
+    .method_call = menu_method_call,
+    .get_property = menu_get_property,
+};
+
+static void register_with_watcher(void) {
+    if (!ctx.connection || !ctx.name_acquired) return;
+    g_dbus_connection_call(ctx.connection, "org.kde.StatusNotifierWatcher", "/StatusNotifierWatcher",
+                           "org.kde.StatusNotifierWatcher", "RegisterStatusNotifierItem",
+                           g_variant_new("(s)", ctx.bus_name), NULL, G_DBUS_CALL_FLAGS_NONE,
+                           -1, NULL, NULL, NULL);
+}
+
+static void on_name_acquired(GDBusConnection *connection, const gchar *name, gpointer data) {
+    (void)connection; (void)name; (void)data;
+    ctx.name_acquired = 1;
+    register_with_watcher();
+}
+
+// Export the item and menu objects the first time a host shows up
+static int export_objects(GDBusConnection *connection) {
+    ctx.introspection = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+    if (!ctx.introspection) return -1;
+
+    ctx.item_id = g_dbus_connection_register_object(connection, ITEM_PATH,
+        g_dbus_node_info_lookup_interface(ctx.introspection, "org.kde.StatusNotifierItem"),
+        &item_vtable, NULL, NULL, NULL);
+    ctx.menu_id = g_dbus_connection_register_object(connection, MENU_PATH,
+        g_dbus_node_info_lookup_interface(ctx.introspection, "com.canonical.dbusmenu"),
+        &menu_vtable, NULL, NULL, NULL);
+    if (!ctx.item_id || !ctx.menu_id) {
+        fprintf(stderr, "Failed to export tray icon\n");
         return -1;
     }
 
-    ctx.indicator = app_indicator_new("keypop-tray", 
-                                      "input-keyboard", 
-                                      APP_INDICATOR_CATEGORY_APPLICATION_STATUS);
-    
-    app_indicator_set_status(ctx.indicator, APP_INDICATOR_STATUS_ACTIVE);
-    
-    char cwd[1024];
+    char cwd[512];
     if (getcwd(cwd, sizeof(cwd))) {
-        char icon_path[2048];
-        snprintf(icon_path, sizeof(icon_path), "%s/public", cwd); 
-        app_indicator_set_icon_theme_path(ctx.indicator, icon_path);
-        app_indicator_set_icon(ctx.indicator, "key_pop"); 
+        snprintf(ctx.icon_theme_path, sizeof(ctx.icon_theme_path), "%s/public", cwd);
     }
 
-    ctx.menu = gtk_menu_new();
-    
-    // Show Overlay - Default is CHECKED (☑) because overlay_enabled = 1 (shown)
-    ctx.toggle_item = gtk_menu_item_new_with_label("☑ Show && hide");
-    g_signal_connect(ctx.toggle_item, "activate", G_CALLBACK(on_toggle_activate), state);
-    gtk_menu_shell_append(GTK_MENU_SHELL(ctx.menu), ctx.toggle_item);
-    
-    GtkWidget *quit_item = gtk_menu_item_new_with_label("Exit");
-    g_signal_connect(quit_item, "activate", G_CALLBACK(on_exit_activate), state);
-    gtk_menu_shell_append(GTK_MENU_SHELL(ctx.menu), quit_item);
-    
-    gtk_widget_show_all(ctx.menu);
-    app_indicator_set_menu(ctx.indicator, GTK_MENU(ctx.menu));
-
+    snprintf(ctx.bus_name, sizeof(ctx.bus_name), "org.kde.StatusNotifierItem-%d-1", (int)getpid());
+    ctx.own_id = g_bus_own_name_on_connection(connection, ctx.bus_name, G_BUS_NAME_OWNER_FLAGS_NONE,
+                                              on_name_acquired, NULL, NULL, NULL);
     return 0;
 }
 
+// The tray only has somewhere to show up once a host is registered. A host
+// that restarts gets the item registered again.
+static void on_watcher_appeared(GDBusConnection *connection, const gchar *name,
+                                const gchar *owner, gpointer data) {
+    (void)name; (void)owner; (void)data;
+    if (!ctx.connection) {
+        ctx.connection = g_object_ref(connection);
+        if (export_objects(connection) != 0) return;
+    }
+    register_with_watcher();
+}
+
+int tray_init(struct client_state *state) {
+    ctx.state = state;
+    ctx.watch_id = g_bus_watch_name(G_BUS_TYPE_SESSION, "org.kde.StatusNotifierWatcher",
+                                    G_BUS_NAME_WATCHER_FLAGS_NONE, on_watcher_appeared, NULL,
+                                    NULL, NULL);
+    return ctx.watch_id ? 0 : -1;
+}
+
 void tray_destroy(struct client_state *state) {
     (void)state;
+    if (ctx.watch_id) g_bus_unwatch_name(ctx.watch_id);
+    if (ctx.own_id) g_bus_unown_name(ctx.own_id);
+    if (ctx.connection) {
+        if (ctx.item_id) g_dbus_connection_unregister_object(ctx.connection, ctx.item_id);
+        if (ctx.menu_id) g_dbus_connection_unregister_object(ctx.connection, ctx.menu_id);
+        g_object_unref(ctx.connection);
+    }
+    if (ctx.introspection) g_dbus_node_info_unref(ctx.introspection);
+    memset(&ctx, 0, sizeof(ctx));
 }
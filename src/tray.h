@@ -3,6 +3,8 @@
 
 #include "state.h"
 
+// Export the tray icon from the main loop once a StatusNotifier host is on the
+// session bus; nothing is done before that
 int tray_init(struct client_state *state);
 void tray_destroy(struct client_state *state);
 
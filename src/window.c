@@ -1,43 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
 #include "window.h"
 #include "draw.h"
+#include "buffer.h"
+
+static inline long time_diff_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
 
 static void xdg_surface_configure(void *data, struct xdg_surface *surface, uint32_t serial) {
     struct client_state *state = data;
     xdg_surface_ack_configure(surface, serial);
-    if (state->window_visible) redraw(state);
+    state->configured = 1;
+    if (state->window_visible) {
+        state->needs_redraw = 1;
+        schedule_frame(state);
+    }
 }
 static const struct xdg_surface_listener xdg_surface_listener = { .configure = xdg_surface_configure };
 
+// Hide without unmapping: the transparent buffer goes up, and the bare
+// background is pre-rendered into a pool buffer so the next key only paints
+// its own segment and commits once. No configure round trip, no allocation.
+static int window_park(struct client_state *state) {
+    const int resized = shm_pool_resize(&state->pool, state->shm, state->width, state->height, frame_format(state));
+    if (resized < 0) return -1;
+    if (resized) state->last_frame.valid = 0;
+    wl_surface_attach(state->surface, state->pool.clear.wl_buffer, 0, 0);
+    set_opaque(state, 0); // Or the compositor would show black where nothing is drawn
+    wl_surface_damage_buffer(state->surface, 0, 0, state->width, state->height);
+    wl_surface_commit(state->surface);
+
+    struct shm_buffer *buffer = shm_pool_acquire(&state->pool);
+    if (buffer) draw_frame(state, buffer); // Its damage goes out with the next shown frame
+    else state->last_frame.valid = 0;
+    return 0;
+}
+
 static void xdg_toplevel_configure(void *data, struct xdg_toplevel *toplevel, int32_t w, int32_t h, struct wl_array *states) {
     (void)data; (void)toplevel; (void)w; (void)h; (void)states;
 }
 static void xdg_toplevel_close(void *data, struct xdg_toplevel *toplevel) {
     (void)toplevel;
-    ((struct client_state *)data)->running = 0;
+    struct client_state *state = data;
+    state->running = 0;
+    loop_quit(state->loop);
 }
 static const struct xdg_toplevel_listener xdg_toplevel_listener = {
     .configure = xdg_toplevel_configure,
     .close = xdg_toplevel_close,
 };
 
+static void layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface, uint32_t serial,
+                                    uint32_t w, uint32_t h) {
+    (void)w; (void)h; // We always ask for our own size
+    struct client_state *state = data;
+    zwlr_layer_surface_v1_ack_configure(surface, serial);
+    state->configured = 1;
+    if (state->window_visible) {
+        state->needs_redraw = 1;
+        schedule_frame(state);
+    } else if (state->warm_hide) {
+        window_park(state); // Mapped from the start, so even the first key is warm
+    }
+}
+static void layer_surface_closed(void *data, struct zwlr_layer_surface_v1 *surface) {
+    (void)surface;
+    struct client_state *state = data;
+    state->running = 0;
+    loop_quit(state->loop);
+}
+static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
+    .configure = layer_surface_configure,
+    .closed = layer_surface_closed,
+};
+
+// Sent before every initial commit, an unmapped layer surface starts over
+static void layer_surface_setup(struct client_state *state) {
+    zwlr_layer_surface_v1_set_size(state->layer_surface, state->width, state->height);
+    zwlr_layer_surface_v1_set_anchor(state->layer_surface, state->anchor);
+    zwlr_layer_surface_v1_set_margin(state->layer_surface, state->margin, state->margin, state->margin, state->margin);
+    zwlr_layer_surface_v1_set_keyboard_interactivity(state->layer_surface,
+                                                     ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_NONE);
+}
+
 void window_create(struct client_state *state) {
     state->surface = wl_compositor_create_surface(state->compositor);
-    state->xdg_surface = xdg_wm_base_get_xdg_surface(state->xdg_wm_base, state->surface);
-    xdg_surface_add_listener(state->xdg_surface, &xdg_surface_listener, state);
-    
-    state->xdg_toplevel = xdg_surface_get_toplevel(state->xdg_surface);
-    xdg_toplevel_add_listener(state->xdg_toplevel, &xdg_toplevel_listener, state);
-    xdg_toplevel_set_app_id(state->xdg_toplevel, "keypop");
-    xdg_toplevel_set_title(state->xdg_toplevel, "Show Me The Key");
+    if (state->layer_shell) {
+        // An overlay the compositor only has to stack, never manage
+        state->layer_surface = zwlr_layer_shell_v1_get_layer_surface(state->layer_shell, state->surface, NULL,
+                                                                     ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "keypop");
+        zwlr_layer_surface_v1_add_listener(state->layer_surface, &layer_surface_listener, state);
+        layer_surface_setup(state);
+    } else {
+        // A transparent toplevel would still take up room in tiling layouts
+        state->warm_hide = 0;
+        state->xdg_surface = xdg_wm_base_get_xdg_surface(state->xdg_wm_base, state->surface);
+        xdg_surface_add_listener(state->xdg_surface, &xdg_surface_listener, state);
+        
+        state->xdg_toplevel = xdg_surface_get_toplevel(state->xdg_surface);
+        xdg_toplevel_add_listener(state->xdg_toplevel, &xdg_toplevel_listener, state);
+        xdg_toplevel_set_app_id(state->xdg_toplevel, "keypop");
+        xdg_toplevel_set_title(state->xdg_toplevel, "Show Me The Key");
+    }
+
+    // Pointer events pass through to whatever is underneath
+    struct wl_region *region = wl_compositor_create_region(state->compositor);
+    wl_surface_set_input_region(state->surface, region);
+    wl_region_destroy(region);
     wl_surface_commit(state->surface);
 }
 
 void hide_window(struct client_state *state) {
     if (!state->window_visible) return;
     state->window_visible = 0;
-    state->display_buf[0] = '\0';
-    state->display_len = 0;
-    state->seg_count = 0;
+    buf_clear(state);
+    state->last_frame.valid = 0;
+    state->latency_pending = (struct latency_mark){0}; // Never reaches the screen
+    if (state->warm_hide && window_park(state) == 0) {
+        wl_display_flush(state->display);
+        return;
+    }
+    // An unmapped surface never gets frame callbacks, drop the pending one
+    if (state->frame_cb) {
+        wl_callback_destroy(state->frame_cb);
+        state->frame_cb = NULL;
+    }
     wl_surface_attach(state->surface, NULL, 0, 0);
     wl_surface_commit(state->surface);
+    if (state->layer_surface) {
+        // Remapping takes a fresh initial commit and configure, start it now
+        // so the next key doesn't wait for the round trip
+        state->configured = 0;
+        layer_surface_setup(state);
+        wl_surface_commit(state->surface);
+    }
+    wl_display_flush(state->display);
+}
+
+// Fires once per deadline. Key activity only moves last_key_time forward, so
+// instead of re-adding a source on every key we re-arm for the remainder here.
+static int hide_timeout(void *data) {
+    struct client_state *state = data;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long elapsed = time_diff_ms(&state->last_key_time, &now);
+    if (elapsed < HIDE_TIMEOUT_MS) {
+        state->hide_timer_id = loop_add_timeout(state->loop, HIDE_TIMEOUT_MS - elapsed, hide_timeout, state);
+        return 0;
+    }
+
+    state->hide_timer_id = 0;
+    hide_window(state);
+    state->needs_redraw = 0; // hide_window commits, so no redraw needed
+    return 0;
+}
+
+void show_window(struct client_state *state) {
+    state->window_visible = 1;
+    clock_gettime(CLOCK_MONOTONIC, &state->last_key_time);
+    if (!state->hide_timer_id) {
+        state->hide_timer_id = loop_add_timeout(state->loop, HIDE_TIMEOUT_MS, hide_timeout, state);
+    }
 }
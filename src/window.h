@@ -5,5 +5,7 @@
 
 void window_create(struct client_state *state);
 void hide_window(struct client_state *state);
+// Mark visible and push the auto-hide deadline HIDE_TIMEOUT_MS into the future
+void show_window(struct client_state *state);
 
 #endif
@@ -3,10 +3,11 @@
 #include <unistd.h>
 #include <wayland-client.h>
 #include "wl_setup.h"
+#include "keymap.h"
 
 static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard, uint32_t format, int32_t fd, uint32_t size) {
-    (void)data; (void)wl_keyboard; (void)format; (void)fd; (void)size;
-    close(fd);
+    (void)wl_keyboard;
+    keymap_from_fd(data, format, fd, size);
 }
 static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial, struct wl_surface *surface, struct wl_array *keys) {
     (void)data; (void)wl_keyboard; (void)serial; (void)surface; (void)keys;
@@ -55,6 +56,13 @@ static void xdg_wm_base_ping(void *data, struct xdg_wm_base *base, uint32_t seri
 }
 static const struct xdg_wm_base_listener xdg_wm_base_listener = { .ping = xdg_wm_base_ping };
 
+static void presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id) {
+    (void)presentation;
+    struct client_state *state = data;
+    state->presentation_clock = clk_id;
+}
+static const struct wp_presentation_listener presentation_listener = { .clock_id = presentation_clock_id };
+
 static void registry_global(void *data, struct wl_registry *reg, uint32_t name, 
                             const char *iface, uint32_t version) {
     (void)version;
@@ -69,6 +77,11 @@ static void registry_global(void *data, struct wl_registry *reg, uint32_t name,
     } else if (strcmp(iface, wl_seat_interface.name) == 0) {
         s->seat = wl_registry_bind(reg, name, &wl_seat_interface, 5);
         wl_seat_add_listener(s->seat, &seat_listener, s);
+    } else if (strcmp(iface, zwlr_layer_shell_v1_interface.name) == 0) {
+        s->layer_shell = wl_registry_bind(reg, name, &zwlr_layer_shell_v1_interface, 1);
+    } else if (strcmp(iface, wp_presentation_interface.name) == 0) {
+        s->presentation = wl_registry_bind(reg, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(s->presentation, &presentation_listener, s);
     }
 }
 static void registry_global_remove(void *data, struct wl_registry *reg, uint32_t name) { (void)data; (void)reg; (void)name; }
@@ -85,11 +98,12 @@ int wl_setup_connect(struct client_state *state) {
     wl_registry_add_listener(state->registry, &registry_listener, state);
     wl_display_roundtrip(state->display);
     
-    if (!state->compositor || !state->shm || !state->xdg_wm_base) return -1;
+    if (!state->compositor || !state->shm || (!state->xdg_wm_base && !state->layer_shell)) return -1;
     return 0;
 }
 
 
 void wl_setup_disconnect(struct client_state *state) {
+    if (state->presentation) wp_presentation_destroy(state->presentation);
     if (state->display) wl_display_disconnect(state->display);
 }